@@ -0,0 +1,213 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+// Compares the compression backends paddlefish was built with on typical
+// payloads: page contents, raw images and files such as ICC profiles or
+// fonts. The files are given as arguments; by default, the ICC profiles in
+// ../resources are used. For each backend and level it prints the
+// throughput and the compression ratio.
+
+#include <paddlefish/flate.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef PADDLEFISH_USE_ZLIB
+
+using paddlefish::flate::CompressionPolicy;
+
+struct Payload
+{
+  std::string name;
+  std::vector<std::string> buffers;
+};
+
+// Page contents of about 4 KB, with drawing and text operators.
+static Payload page_contents()
+{
+  Payload p;
+  p.name = "page contents";
+  unsigned seed = 12345;
+  char line[80];
+  for (int page = 0; page < 1000; ++page)
+  {
+    std::string s;
+    while (s.size() < 4096)
+    {
+      seed = seed * 1103515245 + 12345;
+      unsigned x = (seed >> 8) % 600;
+      seed = seed * 1103515245 + 12345;
+      unsigned y = (seed >> 8) % 800;
+      std::snprintf(line, sizeof(line),
+                    "BT /F1 12 Tf %u %u Td (Line %u) Tj ET %u %u m %u %u l S\n",
+                    x, y, y, x, y, x + 17, y + 3);
+      s += line;
+    }
+    p.buffers.push_back(s);
+  }
+
+  return p;
+}
+
+// An RGB image of 1024 x 1024 pixels with smooth gradients and noise, as a
+// photograph or a scanned page.
+static Payload raw_image()
+{
+  Payload p;
+  p.name = "raw image";
+  const unsigned size = 1024;
+  std::string s(size * size * 3, '\0');
+  unsigned seed = 1;
+  for (unsigned y = 0; y < size; ++y)
+  {
+    for (unsigned x = 0; x < size; ++x)
+    {
+      seed = seed * 1103515245 + 12345;
+      unsigned noise = (seed >> 16) % 8;
+      size_t i = ((size_t)y * size + x) * 3;
+      s[i] = (char)((x / 4 + noise) & 0xff);
+      s[i + 1] = (char)((y / 4 + noise) & 0xff);
+      s[i + 2] = (char)(((x + y) / 8 + noise) & 0xff);
+    }
+  }
+  p.buffers.push_back(s);
+
+  return p;
+}
+
+static bool read_file(const std::string &name, Payload &p)
+{
+  std::ifstream f(name, std::ios_base::in | std::ios_base::binary);
+  if (!f)
+  {
+    std::cerr << "cannot read " << name << std::endl;
+    return false;
+  }
+  std::stringstream ss;
+  ss << f.rdbuf();
+  p.buffers.push_back(ss.str());
+
+  return true;
+}
+
+static void run(const Payload &p, CompressionPolicy policy)
+{
+  size_t input = 0;
+  for (size_t i = 0; i < p.buffers.size(); ++i)
+  {
+    input += p.buffers[i].size();
+  }
+  // Repeat small payloads so that each measure processes about 16 MB.
+  size_t rounds = (16u << 20) / input + 1;
+
+  paddlefish::flate::Deflater deflater(policy);
+  std::string out;
+  size_t output = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t r = 0; r < rounds; ++r)
+  {
+    output = 0;
+    for (size_t i = 0; i < p.buffers.size(); ++i)
+    {
+      out.clear();
+      output += deflater.compress(p.buffers[i].data(),
+                                  p.buffers[i].size(),
+                                  out);
+    }
+  }
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+
+  std::printf("%-16s %-12s level %d  %8.1f MB/s  ratio %5.2f\n",
+              p.name.c_str(),
+              paddlefish::flate::backend_name(policy.backend).c_str(),
+              policy.level,
+              (double)input * rounds / (1 << 20) / d.count(),
+              (double)input / output);
+
+  return;
+}
+
+int main(int argc, char **argv)
+{
+  std::vector<Payload> payloads;
+  payloads.push_back(page_contents());
+  payloads.push_back(raw_image());
+
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; ++i)
+  {
+    files.push_back(argv[i]);
+  }
+  if (files.empty())
+  {
+    files.push_back("../resources/sRGB.icc");
+    files.push_back("../resources/compatibleWithAdobeRGB1998.icc");
+  }
+  Payload file_payload;
+  file_payload.name = "files";
+  for (size_t i = 0; i < files.size(); ++i)
+  {
+    read_file(files[i], file_payload);
+  }
+  if (!file_payload.buffers.empty())
+  {
+    payloads.push_back(file_payload);
+  }
+
+  const CompressionPolicy::Backend backends[] = {
+    CompressionPolicy::Backend::ZLIB,
+    CompressionPolicy::Backend::LIBDEFLATE
+  };
+  const int levels[] = { 1, 6, 9 };
+
+  for (size_t p = 0; p < payloads.size(); ++p)
+  {
+    for (CompressionPolicy::Backend backend : backends)
+    {
+      if (!paddlefish::flate::backend_available(backend))
+      {
+        continue;
+      }
+      for (int level : levels)
+      {
+        CompressionPolicy policy(level);
+        policy.backend = backend;
+        run(payloads[p], policy);
+      }
+    }
+  }
+
+  return 0;
+}
+
+#else
+
+int main(int, char**)
+{
+  std::cerr << "paddlefish was built without zlib" << std::endl;
+
+  return 1;
+}
+
+#endif // PADDLEFISH_USE_ZLIB
+
+// vim: ts=2:sw=2:expandtab
@@ -0,0 +1,154 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+// Measures how a compression cache speeds up documents which share their
+// static assets: a color profile read from a file, an embedded font given
+// as a custom stream and a logo added as an image resource, which are the
+// objects a cache keeps; page images are not cached. The same documents
+// are written without a cache and with one, kept in the directory given as
+// argument (paddlefish_cache by default). The first document with the
+// cache fills it, unless an earlier run did; the next ones find the assets
+// there.
+
+#include <paddlefish/paddlefish.h>
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef PADDLEFISH_USE_ZLIB
+
+static const unsigned DOCUMENTS = 20;
+static const unsigned LOGO_SIZE = 1024;
+static const size_t FONT_SIZE = 1 << 18;
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  return d.count();
+}
+
+// A document with the shared assets and some text of its own.
+static size_t write_document(
+    const paddlefish::flate::CompressionPolicy &policy,
+    const std::vector<unsigned char> &logo,
+    const std::string &font,
+    unsigned number)
+{
+  using namespace paddlefish;
+
+  DocumentPtr d(new Document());
+  d->set_compression_policy(policy);
+  d->add_icc_color_profile("../resources/sRGB.icc", 3);
+  d->add_custom_stream(font, "   /Length1 " + util::to_str(font.size()),
+                       true);
+  unsigned logo_id = d->add_image_resource(logo.data(), NULL, 8, 3,
+                                           LOGO_SIZE, LOGO_SIZE,
+                                           LOGO_SIZE, LOGO_SIZE);
+
+  PagePtr p(new Page());
+  p->add_image_resource(logo_id);
+  p->add_command("q\n" + util::to_str(INCHES(1.5)) + " 0 0 " +
+                 util::to_str(INCHES(1.5)) + ' ' + util::to_str(INCHES(.5)) +
+                 ' ' + util::to_str(INCHES(9)) + " cm\n/Im" +
+                 util::to_str(logo_id) + " Do\nQ\n");
+  unsigned courier = d->add_standard_type1_font("Courier");
+  p->add_text(courier, 12, INCHES(.5), INCHES(8),
+              "Invoice " + util::to_str(number));
+  d->push_back_page(p);
+
+  std::ostringstream pdf;
+  d->to_stream(pdf);
+
+  return pdf.str().size();
+}
+
+int main(int argc, char **argv)
+{
+  using namespace paddlefish;
+
+  std::string directory = argc > 1 ? argv[1] : "paddlefish_cache";
+
+  // A smooth logo with some noise, and a font-like stream.
+  std::vector<unsigned char> logo((size_t)LOGO_SIZE * LOGO_SIZE * 3);
+  unsigned seed = 1;
+  for (size_t i = 0; i < logo.size(); ++i)
+  {
+    seed = seed * 1103515245 + 12345;
+    size_t pixel = i / 3;
+    logo[i] = (unsigned char)((pixel % LOGO_SIZE) / 4 +
+                              (pixel / LOGO_SIZE) / 8 + (seed >> 28));
+  }
+  std::string font;
+  while (font.size() < FONT_SIZE)
+  {
+    seed = seed * 1103515245 + 12345;
+    font += "glyph " + util::to_str(seed % 400) + " rlineto ";
+  }
+
+  flate::CompressionPolicy policy;
+  policy.predictors = true;
+
+  auto start = std::chrono::steady_clock::now();
+  size_t size = 0;
+  for (unsigned i = 0; i < DOCUMENTS; ++i)
+  {
+    size = write_document(policy, logo, font, i);
+  }
+  double seconds = seconds_since(start);
+  std::printf("without cache:        %7.2f ms per document, %zu bytes\n",
+              1000 * seconds / DOCUMENTS, size);
+
+  policy.cache = std::make_shared<flate::CompressionCache>(directory);
+  start = std::chrono::steady_clock::now();
+  write_document(policy, logo, font, 0);
+  seconds = seconds_since(start);
+  flate::CacheStats stats = policy.cache->get_stats();
+  std::printf("first with cache:     %7.2f ms, %lu hits, %lu misses\n",
+              1000 * seconds, stats.hits, stats.misses);
+
+  start = std::chrono::steady_clock::now();
+  for (unsigned i = 1; i < DOCUMENTS; ++i)
+  {
+    size = write_document(policy, logo, font, i);
+  }
+  seconds = seconds_since(start);
+  stats = policy.cache->get_stats();
+  std::printf("next ones with cache: %7.2f ms per document, %zu bytes, "
+              "%lu hits, %lu misses\n",
+              1000 * seconds / (DOCUMENTS - 1), size, stats.hits,
+              stats.misses);
+
+  return 0;
+}
+
+#else
+
+int main(int, char**)
+{
+  std::cerr << "paddlefish was built without zlib" << std::endl;
+
+  return 1;
+}
+
+#endif // PADDLEFISH_USE_ZLIB
+
+// vim: ts=2:sw=2:expandtab
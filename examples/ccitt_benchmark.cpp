@@ -0,0 +1,244 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+// Compares CCITT Group 4 and flate on bilevel images that look like scanned
+// pages: letter pages at 300 dpi with lines of text, some of them with scan
+// noise and some with a dithered picture. For each kind of page it prints
+// the size and the time of both encodings, and then the size and the time
+// of writing a document with all the pages using either compression.
+
+#include <paddlefish/ccitt.h>
+#include <paddlefish/paddlefish.h>
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef PADDLEFISH_USE_ZLIB
+
+static const unsigned WIDTH = 2550;
+static const unsigned HEIGHT = 3300;
+static const unsigned STRIDE = (WIDTH + 7) / 8;
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  return d.count();
+}
+
+// A small linear congruential generator, so that the pages are the same on
+// every platform.
+static unsigned next_random(unsigned &state)
+{
+  state = state * 1103515245u + 12345u;
+  return (state >> 16) & 0x7fff;
+}
+
+// Paints a black pixel, which is a clear bit in a DeviceGray image.
+static void set_pixel(std::vector<unsigned char> &page, unsigned x, unsigned y)
+{
+  if (x < WIDTH && y < HEIGHT)
+  {
+    page[y * STRIDE + x / 8] &= (unsigned char)~(0x80 >> (x % 8));
+  }
+
+  return;
+}
+
+// Draws lines of text-like glyphs, which are random strokes in a cell, with
+// margins and gaps between words.
+static void draw_text(std::vector<unsigned char> &page,
+                      unsigned top,
+                      unsigned bottom,
+                      unsigned &state)
+{
+  for (unsigned line = top; line + 40 < bottom; line += 50)
+  {
+    unsigned x = 300;
+    while (x + 30 < WIDTH - 300)
+    {
+      unsigned word = 2 + next_random(state) % 8;
+      for (unsigned g = 0; g < word && x + 30 < WIDTH - 300; ++g, x += 26)
+      {
+        unsigned strokes = 2 + next_random(state) % 3;
+        for (unsigned s = 0; s < strokes; ++s)
+        {
+          // Vertical or horizontal strokes, 3 or 4 pixels thick, with
+          // ragged edges as in a scan.
+          if (next_random(state) % 2)
+          {
+            unsigned sx = x + next_random(state) % 18;
+            unsigned len = 15 + next_random(state) % 20;
+            for (unsigned yy = line + 35 - len; yy < line + 35; ++yy)
+            {
+              unsigned thick = 3 + next_random(state) % 2;
+              for (unsigned t = 0; t < thick; ++t)
+                set_pixel(page, sx + t, yy);
+            }
+          }
+          else
+          {
+            unsigned sy = line + 10 + next_random(state) % 25;
+            for (unsigned xx = x; xx < x + 20; ++xx)
+            {
+              unsigned thick = 3 + next_random(state) % 2;
+              for (unsigned t = 0; t < thick; ++t)
+                set_pixel(page, xx, sy + t);
+            }
+          }
+        }
+      }
+      x += 26;
+    }
+  }
+
+  return;
+}
+
+// Isolated black specks, as left by a dirty scanner glass.
+static void draw_noise(std::vector<unsigned char> &page, unsigned &state)
+{
+  for (unsigned i = 0; i < 20000; ++i)
+  {
+    unsigned x = (next_random(state) << 15 | next_random(state)) % WIDTH;
+    unsigned y = (next_random(state) << 15 | next_random(state)) % HEIGHT;
+    set_pixel(page, x, y);
+  }
+
+  return;
+}
+
+// A gradient with ordered dithering, as a picture in a scanned page.
+static void draw_picture(std::vector<unsigned char> &page,
+                         unsigned top,
+                         unsigned bottom)
+{
+  static const unsigned bayer[4][4] = {
+    { 0, 8, 2, 10 }, { 12, 4, 14, 6 }, { 3, 11, 1, 9 }, { 15, 7, 13, 5 }
+  };
+  for (unsigned y = top; y < bottom; ++y)
+  {
+    for (unsigned x = 300; x < WIDTH - 300; ++x)
+    {
+      unsigned level = (x - 300) * 16 / (WIDTH - 600);
+      if (level > bayer[y % 4][x % 4])
+      {
+        set_pixel(page, x, y);
+      }
+    }
+  }
+
+  return;
+}
+
+int main()
+{
+  using namespace paddlefish;
+
+  const char *names[] = { "text", "text with noise", "text and picture" };
+  std::vector<std::vector<unsigned char> > pages;
+  unsigned state = 1;
+  for (unsigned kind = 0; kind < 3; ++kind)
+  {
+    std::vector<unsigned char> page(STRIDE * HEIGHT, 0xff);
+    if (kind == 2)
+    {
+      draw_text(page, 300, 1400, state);
+      draw_picture(page, 1500, 2400);
+      draw_text(page, 2500, HEIGHT - 300, state);
+    }
+    else
+    {
+      draw_text(page, 300, HEIGHT - 300, state);
+    }
+    if (kind == 1)
+    {
+      draw_noise(page, state);
+    }
+    pages.push_back(page);
+  }
+
+  const unsigned REPEAT = 10;
+  std::printf("%-18s %10s %10s %9s %10s %9s\n",
+              "page", "raw", "g4", "g4 ms", "flate", "flate ms");
+  for (unsigned i = 0; i < pages.size(); ++i)
+  {
+    std::string g4, deflated;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned r = 0; r < REPEAT; ++r)
+    {
+      g4.clear();
+      ccitt::g4_encode(pages[i].data(), STRIDE, WIDTH, HEIGHT, g4);
+    }
+    double g4_time = seconds_since(start) / REPEAT;
+
+    start = std::chrono::steady_clock::now();
+    for (unsigned r = 0; r < REPEAT; ++r)
+    {
+      deflated.clear();
+      flate::PooledDeflater()->compress((const char*)pages[i].data(),
+                                        pages[i].size(),
+                                        deflated);
+    }
+    double flate_time = seconds_since(start) / REPEAT;
+
+    std::printf("%-18s %10zu %10zu %9.2f %10zu %9.2f\n",
+                names[i], pages[i].size(), g4.size(), g4_time * 1000,
+                deflated.size(), flate_time * 1000);
+  }
+
+  // Documents with a page per image, written with each compression.
+  for (unsigned use_g4 = 0; use_g4 < 2; ++use_g4)
+  {
+    flate::CompressionPolicy policy;
+    policy.ccitt_g4 = use_g4 != 0;
+    auto start = std::chrono::steady_clock::now();
+    DocumentPtr d(new Document());
+    d->set_compression_policy(policy);
+    for (unsigned i = 0; i < pages.size(); ++i)
+    {
+      PagePtr p(new Page());
+      p->set_mediabox(0, 0, 612, 792);
+      p->add_image_bytes(pages[i].data(), NULL, 1, 1, WIDTH, HEIGHT,
+                         0, 0, 612, 792, COLORSPACE_DEVICEGRAY);
+      d->push_back_page(p);
+    }
+    std::ostringstream pdf;
+    d->to_stream(pdf);
+    std::printf("document with %-5s %10zu bytes %9.2f ms\n",
+                use_g4 ? "g4" : "flate", pdf.str().size(),
+                seconds_since(start) * 1000);
+  }
+
+  return 0;
+}
+
+#else
+
+int main(int, char**)
+{
+  std::cerr << "paddlefish was built without zlib" << std::endl;
+
+  return 1;
+}
+
+#endif // PADDLEFISH_USE_ZLIB
+
+// vim: ts=2:sw=2:expandtab
@@ -0,0 +1,163 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+// Measures the throughput of the deflate engine on inputs of the size of a
+// page content stream and on inputs of several megabytes, like big images.
+// The optional arguments are the compression level and the number of
+// threads; it prints MB/s for each size.
+
+#include <paddlefish/flate.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#ifdef PADDLEFISH_USE_ZLIB
+
+// Text resembling a page content stream: short drawing and text operators
+// with pseudo-random coordinates.
+static std::string make_input(size_t size)
+{
+  std::string s;
+  s.reserve(size + 64);
+  unsigned seed = 12345;
+  char line[64];
+  while (s.size() < size)
+  {
+    seed = seed * 1103515245 + 12345;
+    unsigned x = (seed >> 8) % 600;
+    seed = seed * 1103515245 + 12345;
+    unsigned y = (seed >> 8) % 800;
+    std::snprintf(line, sizeof(line), "%u.%u %u.%u m %u %u l S\n",
+                  x, y % 10, y, x % 10, x + 17, y + 3);
+    s += line;
+  }
+  s.resize(size);
+
+  return s;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  return d.count();
+}
+
+static void run(size_t size,
+                const paddlefish::flate::CompressionPolicy &policy)
+{
+  using paddlefish::flate::Deflater;
+  using paddlefish::flate::Inflater;
+
+  std::string input = make_input(size);
+  // Repeat small inputs so that each measure processes about 16 MB.
+  size_t rounds = (16u << 20) / size;
+  if (rounds == 0)
+  {
+    rounds = 1;
+  }
+  double megabytes = (double)size * rounds / (1 << 20);
+
+  std::string compressed;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < rounds; ++i)
+  {
+    compressed = paddlefish::flate::deflate_buffer(input.data(),
+                                                   (unsigned)input.size(),
+                                                   policy);
+  }
+  double one_shot = megabytes / seconds_since(start);
+
+  Deflater deflater(policy);
+  start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < rounds; ++i)
+  {
+    compressed.clear();
+    deflater.compress(input.data(), input.size(), compressed);
+  }
+  double reused = megabytes / seconds_since(start);
+
+  std::ostringstream sink;
+  start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < rounds; ++i)
+  {
+    sink.str(std::string());
+    deflater.compress(input.data(), input.size(), sink);
+  }
+  double to_stream = megabytes / seconds_since(start);
+
+  Inflater inflater;
+  std::string output;
+  start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < rounds; ++i)
+  {
+    output.clear();
+    inflater.decompress(compressed.data(), compressed.size(), output, size);
+  }
+  double inflated = megabytes / seconds_since(start);
+
+  if (output != input)
+  {
+    std::cerr << "round trip failed for " << size << " bytes" << std::endl;
+    return;
+  }
+
+  std::printf("%9zu bytes  ratio %5.2f  one-shot %7.1f MB/s  reused %7.1f "
+              "MB/s  to stream %7.1f MB/s  inflate %7.1f MB/s\n",
+              size, (double)size / compressed.size(),
+              one_shot, reused, to_stream, inflated);
+
+  return;
+}
+
+int main(int argc, char **argv)
+{
+  paddlefish::flate::CompressionPolicy policy;
+  if (argc > 1)
+  {
+    policy.level = std::atoi(argv[1]);
+  }
+  if (argc > 2)
+  {
+    policy.threads = (unsigned)std::atoi(argv[2]);
+  }
+
+  const size_t sizes[] = { 1 << 10, 4 << 10, 16 << 10, 64 << 10,
+                           1 << 20, 4 << 20, 16 << 20 };
+  for (size_t size : sizes)
+  {
+    run(size, policy);
+  }
+
+  return 0;
+}
+
+#else
+
+int main(int, char**)
+{
+  std::cerr << "paddlefish was built without zlib" << std::endl;
+
+  return 1;
+}
+
+#endif // PADDLEFISH_USE_ZLIB
+
+// vim: ts=2:sw=2:expandtab
@@ -0,0 +1,148 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+// Writes many small documents which share their fonts, color profile,
+// functions, shadings and patterns, first adding those objects to each
+// document, then creating each document from a preamble where they were
+// frozen once. Both ways give the same files. With "1.5" as argument, the
+// documents use object streams, and the objects of the preamble are packed
+// in streams of their own, so the files differ.
+
+#include <paddlefish/paddlefish.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <string>
+
+static const unsigned DOCUMENTS = 200;
+static const unsigned GRADIENTS = 40;
+
+// The identifiers of the shared objects.
+struct Resources
+{
+  unsigned helvetica;
+  unsigned courier;
+  unsigned icc;
+  unsigned gradients[GRADIENTS];
+};
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  return d.count();
+}
+
+static Resources add_resources(paddlefish::Document &d)
+{
+  Resources r;
+
+  r.helvetica = d.add_standard_type1_font("Helvetica");
+  r.courier = d.add_standard_type1_font("Courier");
+  r.icc = d.add_icc_color_profile("../resources/sRGB.icc", 3);
+
+  for (unsigned i = 0; i < GRADIENTS; ++i)
+  {
+    double c0[3] = { 1., i / (double)GRADIENTS, 0. };
+    double c1[3] = { 0., 0., 1. };
+    double c2[3] = { 1., 1., 1. };
+    unsigned f[2];
+    f[0] = d.add_interpolation_function(3, c0, c1, 1.);
+    f[1] = d.add_interpolation_function(3, c1, c2, 2.);
+    double bounds[1] = { .5 };
+    double encode[4] = { 0., 1., 0., 1. };
+    unsigned stitching = d.add_stitching_function(2, f, bounds, encode);
+    double coords[4] = { 0., 0., INCHES(8), 0. };
+    unsigned shading = d.add_shading(2, r.icc, coords, 0., 1., stitching,
+                                     true, true);
+    r.gradients[i] = d.add_shading_pattern(shading);
+  }
+
+  return r;
+}
+
+static std::string write_document(paddlefish::DocumentPtr d,
+                                  const Resources &r,
+                                  unsigned number)
+{
+  using namespace paddlefish;
+
+  PagePtr p(new Page());
+  p->set_pattern(0, r.gradients[number % GRADIENTS]);
+  p->add_command(util::to_str(INCHES(.25)) + ' ' + util::to_str(INCHES(10)) +
+                 ' ' + util::to_str(INCHES(8)) + ' ' +
+                 util::to_str(INCHES(.5)) + " re f\n");
+  p->add_text(r.helvetica, 24, INCHES(.5), INCHES(9),
+              "Statement " + util::to_str(number));
+  p->add_text(r.courier, 10, INCHES(.5), INCHES(8.5), "Account 0001");
+  d->push_back_page(p);
+
+  std::ostringstream pdf;
+  d->to_stream(pdf);
+
+  return pdf.str();
+}
+
+int main(int argc, char **argv)
+{
+  using namespace paddlefish;
+
+  Document::OutputProfile profile =
+    (argc > 1 && !std::strcmp(argv[1], "1.5") ?
+     Document::OutputProfile::PDF_1_5 :
+     Document::OutputProfile::PDF_1_4);
+
+  std::string last_rebuilt;
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < DOCUMENTS; ++i)
+  {
+    DocumentPtr d(new Document());
+    d->set_output_profile(profile);
+    Resources r = add_resources(*d);
+    last_rebuilt = write_document(d, r, i);
+  }
+  double seconds = seconds_since(start);
+  std::printf("rebuilding the objects: %7.3f ms per document\n",
+              1000 * seconds / DOCUMENTS);
+
+  start = std::chrono::steady_clock::now();
+  Document frozen;
+  frozen.set_output_profile(profile);
+  Resources r = add_resources(frozen);
+  PreamblePtr preamble = frozen.freeze_preamble();
+  seconds = seconds_since(start);
+  std::printf("freezing the preamble:  %7.3f ms, %zu bytes, %u objects\n",
+              1000 * seconds, preamble->get_bytes().size(),
+              preamble->get_object_count());
+
+  std::string last_copied;
+  start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < DOCUMENTS; ++i)
+  {
+    DocumentPtr d(new Document(preamble));
+    last_copied = write_document(d, r, i);
+  }
+  seconds = seconds_since(start);
+  std::printf("copying the preamble:   %7.3f ms per document, %s output\n",
+              1000 * seconds / DOCUMENTS,
+              last_copied == last_rebuilt ? "same" : "different");
+
+  return 0;
+}
+
+// vim: ts=2:sw=2:expandtab
@@ -0,0 +1,128 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+// Measures how documents with many small compressed streams are written.
+// It first compresses a few thousand small buffers with a new deflater for
+// each one and with pooled deflaters, then writes a document with as many
+// custom streams and small images. For each case it prints the time, the
+// throughput and the number of allocations made by zlib.
+
+#include <paddlefish/paddlefish.h>
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef PADDLEFISH_USE_ZLIB
+
+static const unsigned STREAMS = 4000;
+static const size_t STREAM_SIZE = 2048;
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  return d.count();
+}
+
+static void report(const char *name,
+                   double seconds,
+                   unsigned long allocations)
+{
+  double megabytes = (double)STREAMS * STREAM_SIZE / (1 << 20);
+  std::printf("%-28s %7.3f s  %9.0f streams/s  %6.1f MB/s  "
+              "%8lu zlib allocations\n",
+              name, seconds, STREAMS / seconds, megabytes / seconds,
+              allocations);
+
+  return;
+}
+
+int main()
+{
+  using namespace paddlefish;
+
+  // Small buffers, each one a bit different.
+  std::vector<std::string> inputs(STREAMS);
+  for (unsigned i = 0; i < STREAMS; ++i)
+  {
+    std::string &s = inputs[i];
+    while (s.size() < STREAM_SIZE)
+    {
+      s += util::to_str(i * 7 + s.size() % 97) + " 0 0 RG ";
+    }
+    s.resize(STREAM_SIZE);
+  }
+
+  std::string out;
+  unsigned long allocations = flate::zlib_allocations();
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < STREAMS; ++i)
+  {
+    out.clear();
+    flate::Deflater().compress(inputs[i].data(), inputs[i].size(), out);
+  }
+  report("new deflater per stream", seconds_since(start),
+         flate::zlib_allocations() - allocations);
+
+  allocations = flate::zlib_allocations();
+  start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < STREAMS; ++i)
+  {
+    out.clear();
+    flate::PooledDeflater()->compress(inputs[i].data(),
+                                      inputs[i].size(),
+                                      out);
+  }
+  report("pooled deflater", seconds_since(start),
+         flate::zlib_allocations() - allocations);
+
+  // A document with a custom stream and a small image per input.
+  allocations = flate::zlib_allocations();
+  start = std::chrono::steady_clock::now();
+  DocumentPtr d(new Document());
+  PagePtr p(new Page());
+  for (unsigned i = 0; i < STREAMS; ++i)
+  {
+    d->add_custom_stream(inputs[i], "", true);
+    p->add_image_bytes((const unsigned char*)inputs[i].data(),
+                       NULL, 8, 1, 32, 32, i % 500, i / 8, 10, 10,
+                       COLORSPACE_DEVICEGRAY);
+  }
+  d->push_back_page(p);
+  std::ostringstream pdf;
+  d->to_stream(pdf);
+  report("document", seconds_since(start),
+         flate::zlib_allocations() - allocations);
+
+  return 0;
+}
+
+#else
+
+int main(int, char**)
+{
+  std::cerr << "paddlefish was built without zlib" << std::endl;
+
+  return 1;
+}
+
+#endif // PADDLEFISH_USE_ZLIB
+
+// vim: ts=2:sw=2:expandtab
@@ -0,0 +1,105 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+// Streams a document whose pages borrow their images from the
+// application, and checks that each buffer is given back as soon as its
+// page is written, with image deduplication enabled. Every page also
+// draws the same logo, which must be written only once. It returns
+// nonzero if a buffer is kept longer or the logo is written again.
+
+#include <paddlefish/paddlefish.h>
+
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static const unsigned PAGES = 5;
+static const unsigned SIZE = 64;
+
+// The number of buffers given back to the application.
+static unsigned released = 0;
+
+static void release_buffer(const unsigned char *buffer)
+{
+  delete[] buffer;
+  ++released;
+
+  return;
+}
+
+int main(int, char**)
+{
+  using namespace paddlefish;
+
+  std::vector<unsigned char> logo(SIZE * SIZE * 3);
+  for (size_t i = 0; i < logo.size(); ++i)
+  {
+    logo[i] = (unsigned char)(i % 251);
+  }
+
+  DocumentPtr d(new Document());
+  std::ostringstream pdf;
+  d->start_stream(pdf);
+
+  for (unsigned p = 0; p < PAGES; ++p)
+  {
+    unsigned char *pixels = new unsigned char[SIZE * SIZE * 3];
+    for (size_t i = 0; i < SIZE * SIZE * 3; ++i)
+    {
+      pixels[i] = (unsigned char)(i * (p + 1));
+    }
+
+    PagePtr page(new Page());
+    page->add_image_buffer(ImageBuffer(pixels, release_buffer), ImageBuffer(),
+                           8, 3, SIZE, SIZE,
+                           INCHES(1), INCHES(5), INCHES(4), INCHES(4));
+    page->add_image_bytes(logo.data(), NULL, 8, 3, SIZE, SIZE,
+                          INCHES(1), INCHES(9.5), INCHES(1), INCHES(1));
+    d->push_back_page(page);
+    page.reset();
+
+    std::printf("page %u written, %u buffers released\n", p + 1, released);
+    if (released != p + 1)
+    {
+      std::printf("the document keeps the buffers of written pages\n");
+      return 1;
+    }
+  }
+
+  d->finish_stream();
+
+  // One image per page, plus the logo.
+  std::string contents = pdf.str();
+  unsigned images = 0;
+  for (size_t pos = contents.find("/Subtype /Image");
+       pos != std::string::npos;
+       pos = contents.find("/Subtype /Image", pos + 1))
+  {
+    ++images;
+  }
+  std::printf("%u images written\n", images);
+  if (images != PAGES + 1)
+  {
+    std::printf("the logo was not deduplicated\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+// vim: ts=2:sw=2:expandtab
@@ -0,0 +1,46 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef PADDLEFISH_CCITT_H
+#define PADDLEFISH_CCITT_H
+
+#include <cstddef>
+#include <string>
+
+namespace paddlefish {
+namespace ccitt {
+
+// Encode a bilevel image with CCITT Group 4 (T.6), as the CCITTFaxDecode
+// filter reads it with /K -1. The rows have stride bytes each, with the
+// first pixel in the most significant bit; a set bit is black, so that the
+// decoded rows are the given ones when /BlackIs1 is true. The output is
+// appended, ending with the end-of-block code.
+void g4_encode(const unsigned char *data,
+               size_t stride,
+               unsigned width,
+               unsigned height,
+               std::string &out);
+
+// The /DecodeParms dictionary of an image encoded with g4_encode().
+std::string g4_decode_parms(unsigned columns, unsigned rows);
+
+} // namespace ccitt
+} // namespace paddlefish
+
+#endif // PADDLEFISH_CCITT_H
+
+// vim: ts=2:sw=2:expandtab
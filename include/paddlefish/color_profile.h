@@ -21,6 +21,7 @@
 #include "custom_object.h"
 #include <cstdint>
 #include <memory>
+#include <string>
 
 namespace paddlefish {
 
@@ -65,6 +66,13 @@ public:
   ColorProfile(ColorProfile::Type t, std::string name, unsigned alt_cs_id, unsigned alt_f_id);
 
   PdfObject::Type get_type() const { return PdfObject::Type::COLOR_PROFILE; }
+
+  // Returns the array of an indexed color space. The base is a name or a
+  // reference, and the lookup table has the components of each color, one
+  // color after the other.
+  static std::string indexed_array(const std::string &base,
+                                   const std::string &lookup,
+                                   unsigned num_colors);
 };
 
 } // namespace paddlefish
@@ -41,9 +41,9 @@ class Command: public PdfObject
 
     Type get_type() const { return Type::COMMAND; }
 
-    std::ostream& to_stream(std::ostream& os) const { return os << get_contents(); }
+    std::ostream& to_stream(std::ostream& os) const { return os << contents; }
 
-    const std::string get_contents() const { return contents; }
+    void append_contents(std::string &buffer) const { buffer += contents; }
 
   private:
     std::string contents;
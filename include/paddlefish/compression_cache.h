@@ -0,0 +1,116 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef PADDLEFISH_COMPRESSION_CACHE_H
+#define PADDLEFISH_COMPRESSION_CACHE_H
+
+#include "flate.h"
+#include <atomic>
+#include <cstddef>
+#include <string>
+
+namespace paddlefish {
+namespace flate {
+
+#ifdef PADDLEFISH_USE_ZLIB
+
+// How many payloads were found in a cache, and how many were deflated and
+// stored in it.
+struct CacheStats
+{
+  CacheStats(): hits(0), misses(0) {}
+
+  unsigned long hits;
+  unsigned long misses;
+};
+
+// A directory of deflated payloads, shared by the documents of this and
+// other processes. Each file holds the data deflated with some parameters,
+// and is named after the hash of the data, its size and the parameters.
+// The hash does not identify the data for sure, and files may be damaged,
+// so a payload is inflated and compared with the data before being used;
+// this is much faster than deflating it. Files are written apart and
+// renamed, so that readers never see them half written. Errors reading or
+// writing the directory only make the data be deflated again.
+//
+// A compression policy with a cache uses it for the static assets which
+// are usually the same in every document: file streams, custom streams and
+// image resources, such as fonts, ICC profiles, logos and backgrounds.
+// Page images, often different in each document, page contents and object
+// streams are never cached. Nothing is ever removed from the directory.
+class CompressionCache
+{
+  public:
+    // The directory is created if it does not exist, but not its parents.
+    // Throws std::runtime_error if it cannot be created.
+    CompressionCache(const std::string &directory);
+
+    // Deflate the data with the policy, or take the result of deflating
+    // it before with the same level, strategy, memory level, window bits
+    // and backend. The result is appended to the output and true is
+    // returned. If the policy asks to store incompressible data and the
+    // result is not smaller than store_ratio times the data, false is
+    // returned and the output is left alone; the whole result is compared,
+    // not a sample, since it is kept anyway.
+    bool deflate(const char *data,
+                 size_t size,
+                 const CompressionPolicy &policy,
+                 std::string &out);
+
+    // Same for the contents of a file, which is read in memory.
+    bool deflate_file(const std::string &filename,
+                      const CompressionPolicy &policy,
+                      std::string &out);
+
+    const std::string& get_directory() const { return directory; }
+
+    CacheStats get_stats() const;
+
+  private:
+    CompressionCache(const CompressionCache&) = delete;
+    CompressionCache& operator=(const CompressionCache&) = delete;
+
+    std::string get_path(const char *data,
+                         size_t size,
+                         const CompressionPolicy &policy) const;
+    bool load(const std::string &path,
+              const char *data,
+              size_t size,
+              std::string &deflated) const;
+    void store(const std::string &path, const std::string &deflated) const;
+
+    std::string directory;
+    std::atomic<unsigned long> hits;
+    std::atomic<unsigned long> misses;
+};
+
+// Deflate the data and append the result to the output, with the cache of
+// the policy if it has one. The data is deflated whatever the policy says
+// about incompressible data. Returns the size of the result.
+size_t deflate_cached(const char *data,
+                      size_t size,
+                      const CompressionPolicy &policy,
+                      std::string &out);
+
+#endif // PADDLEFISH_USE_ZLIB
+
+} // namespace flate
+} // namespace paddlefish
+
+#endif // PADDLEFISH_COMPRESSION_CACHE_H
+
+// vim: ts=2:sw=2:expandtab
@@ -36,17 +36,39 @@ public:
 
   CustomObject();
 
-  CustomObject(const std::string& text, bool flate = false);
+  CustomObject(const std::string& text,
+               bool flate = false,
+               bool stream = false);
+
+  // Constructor for a stream object, given the dictionary and the stream
+  // data apart. The data is moved into the object, to avoid copying it.
+  CustomObject(const std::string& dictionary, std::string&& data);
+
+  // Constructor for a stream object whose data is a buffer of the caller.
+  // The object keeps a reference to the buffer and writes it as is.
+  CustomObject(const std::string& dictionary,
+               const std::shared_ptr<const void> &data,
+               size_t data_size);
 
   ~CustomObject() {}
 
+  // Make the object a stream object, given the dictionary and the stream
+  // data apart. This lets the data of an object be built after the object
+  // is added to the document, before it is written.
+  void set_stream(const std::string& dictionary, std::string&& data);
+  void set_stream(const std::string& dictionary,
+                  const std::shared_ptr<const void> &data,
+                  size_t data_size);
+
   bool uses_flate() const { return use_flate; }
 
   Type get_type() const { return Type::CUSTOM_OBJECT; }
 
-  std::ostream& to_stream(std::ostream &os) const { return os << get_contents(); }
+  bool is_stream() const { return stream_object; }
+
+  std::ostream& to_stream(std::ostream &os) const;
 
-  const std::string get_contents() const { return contents; }
+  void append_contents(std::string &buffer) const;
 
 protected:
 
@@ -55,6 +77,17 @@ protected:
 
   // Use flate compression for object contents.
   bool use_flate;
+
+  // The contents are a stream object.
+  bool stream_object;
+
+  // When the stream data is given apart, contents holds the dictionary.
+  std::string stream_data;
+  bool has_stream_data;
+
+  // When not null, the stream data is this buffer instead of stream_data.
+  std::shared_ptr<const void> external_data;
+  size_t external_size;
 };
 
 } // namespace paddlefish
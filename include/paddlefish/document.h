@@ -23,13 +23,23 @@
 #include "graphics_state.h"
 #include "util.h"
 #include "colorspace_properties.h"
+#include "compression_cache.h"
+#include "executor.h"
 #include "ocg.h"
+#include "object_writer.h"
+#include "resample.h"
 #include "resources_dict.h"
+#include "sink.h"
 #include "pdf_object.h"
+#include "preamble.h"
 
+#include <atomic>
+#include <cstdint>
 #include <ios>
 #include <ostream>
+#include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace paddlefish {
@@ -48,11 +58,31 @@ class Document{
         typedef typename std::unordered_map<unsigned, unsigned>
                                                         image_resource_map;
     public:
+        // The output profile determines the PDF version of the output and
+        // how objects are stored. PDF_1_4 writes every object at the top
+        // level of the file, followed by a cross-reference table. PDF_1_5
+        // packs the objects which are not streams into compressed object
+        // streams and writes a compressed cross-reference stream instead
+        // of the table and trailer, which produces much smaller files.
+        enum class OutputProfile:std::uint8_t
+        {
+          PDF_1_4,
+          PDF_1_5
+        };
+
         Document();
+        // Create a document whose body starts with the objects of the given
+        // preamble. Their identifiers, returned when they were added to the
+        // frozen document, are valid in this one, and the document takes
+        // the output profile of the preamble. See freeze_preamble().
+        explicit Document(const PreamblePtr &preamble_ptr);
         ~Document() {}
         Document& operator=(const Document&);
 
-        // Append an already created page to the end of this document.
+        // Append an already created page to the end of this document. When
+        // the document is streaming (see start_stream()), the page is
+        // written immediately and the document keeps no reference to it,
+        // so the page must be complete when it is pushed back.
         void push_back_page(const PagePtr& page_ptr);
 
         // Function to add to the document a standard font. Its only
@@ -118,9 +148,127 @@ class Document{
                                             unsigned alternate_cs,
                                             unsigned alternate_function);
 
-        // Write the entire document to a stream.
+        // Write the entire document to a stream. Streams that cannot tell
+        // their position, such as pipes, are written through a sink.
         std::ostream& to_stream(std::ostream &out_stream);
 
+        // Write the entire document to a sink.
+        void to_sink(Sink &out_sink);
+
+        // Bind the document to an output stream and write the file header.
+        // From this call on, every page pushed back to the document is
+        // written to the stream, preceded by the global objects added
+        // since the previous page, and released. Only the page tree, the
+        // page labels and the cross-reference table are kept until
+        // finish_stream() is called. The stream must outlive the document
+        // or the call to finish_stream().
+        void start_stream(std::ostream &out_stream);
+
+        // Bind the document to a sink, in the same way as above. Then,
+        // finish_stream() returns a stream that writes to the sink, which
+        // is valid until the document is bound again or destroyed.
+        void start_stream(Sink &out_sink);
+
+        // Write the remaining global objects, the document catalog, the
+        // page tree, the page labels, the document information and the
+        // cross-reference table, and unbind the document from the stream.
+        std::ostream& finish_stream();
+
+        // Write the body objects of the document (its preamble, if any,
+        // and the fonts, color profiles, functions, shadings, patterns,
+        // graphics states and custom objects added to it) with the current
+        // output profile, and return them as a preamble, from which other
+        // documents are created. The objects are written as they are now;
+        // graphics states changed afterwards do not change the preamble.
+        // It must not be called while streaming.
+        PreamblePtr freeze_preamble();
+
+        // The preamble the document was created from, or null.
+        const PreamblePtr& get_preamble() const { return preamble; }
+
+        // Returns true between start_stream() and finish_stream().
+        bool is_streaming() const { return bound_stream != nullptr; }
+
+        // Set and get the output profile. It must not be changed while the
+        // document is streaming, and a document created from a preamble
+        // can only be written with the profile of the preamble.
+        void set_output_profile(OutputProfile profile)
+          { output_profile = profile; }
+        OutputProfile get_output_profile() const { return output_profile; }
+
+        // Set the compression policy of the document. It applies to all
+        // the compressed objects, except the ones given their own policy.
+        // It must be set before adding the objects compressed when added:
+        // custom streams and image resources.
+        void set_compression_policy(const flate::CompressionPolicy &policy)
+          { compression_policy = policy; }
+        const flate::CompressionPolicy& get_compression_policy() const
+          { return compression_policy; }
+
+        // Set whether page content streams are compressed with flate. It is
+        // off by default, and each page can override it.
+        void set_content_flate(bool flate) { content_flate = flate; }
+        bool get_content_flate() const { return content_flate; }
+
+        // Enable or disable the deduplication of page images. When enabled,
+        // which is the default, an image identical to one already written
+        // (same pixels or same JPEG file, and same size, colorspace and
+        // filters) is not written again; the pages that use it refer to
+        // the first one.
+        void set_image_deduplication(bool enable)
+          { image_deduplication = enable; }
+        bool get_image_deduplication() const { return image_deduplication; }
+
+        // Limit the resolution of the raw page images with 8 bits per
+        // component to the given dots per inch, at the size they are
+        // drawn. Bigger images are resampled with the given filter when
+        // their pages are numbered, before they are deduplicated and
+        // compressed. Images in indexed colorspaces, whose samples are
+        // palette entries, are never resampled, nor are JPEG and PNG
+        // images. Zero, the default, keeps the images as they are.
+        void set_max_image_resolution(
+            double dpi,
+            resample::Filter filter = resample::Filter::LANCZOS)
+          { max_image_resolution = dpi; image_resampling_filter = filter; }
+        double get_max_image_resolution() const
+          { return max_image_resolution; }
+        resample::Filter get_image_resampling_filter() const
+          { return image_resampling_filter; }
+
+        // Called by the pages when numbering their images. If the image (and
+        // its soft mask, which may be null) is identical to one already
+        // numbered, returns the number of that one. Otherwise, it records
+        // the image, whose number must be set, and returns zero.
+        unsigned share_image(const ImagePtr &image, const ImagePtr &soft_mask);
+
+        // The payloads sampled because of the store_incompressible field of
+        // their compression policy, and how many of them were stored
+        // without compression. Custom streams are counted when added, file
+        // streams and JPEG images each time they are written.
+        flate::SamplingStats get_sampling_stats() const;
+
+        // Count a sampled payload of the given size. The pages call it,
+        // possibly from several threads, for their images.
+        void count_sampling(flate::Sampling sampling, std::uint64_t size);
+
+        // Set the number of threads used by to_stream() to write the pages.
+        // With more than one thread, each page is written to a buffer of
+        // its own by a worker thread, and the buffers are copied to the
+        // output in order. The output is the same as with one thread, which
+        // is the default. Zero means one thread per hardware thread. This
+        // setting does not apply when streaming.
+        void set_serialization_threads(unsigned threads);
+        unsigned get_serialization_threads() const
+          { return serialization_threads; }
+
+        // Set the number of background threads which compress the custom
+        // streams and image resources, so that adding them does not wait
+        // for the compression. The output waits for the pending jobs
+        // before writing them, and it does not depend on the number of
+        // threads. Zero, the default, compresses them when they are added.
+        void set_compression_threads(unsigned threads);
+        unsigned get_compression_threads() const;
+
         // To get the object representing document information.
         Info& get_info() { return document_information; }
 
@@ -147,25 +295,51 @@ class Document{
                                     unsigned width,
                                     unsigned height,
                                     unsigned colorspace = COLORSPACE_DEVICERGB,
-                                    bool flate = true);
+                                    bool flate = true,
+                                    const flate::CompressionPolicy *policy =
+                                      nullptr);
+
+        // Same as above, but the pixels are given in buffers which are
+        // not copied. Deflated images are compressed before returning and
+        // the document does not keep their buffers; uncompressed images
+        // keep them until the document is destroyed. See ImageBuffer.
+        unsigned add_image_resource(const ImageBuffer &bytes,
+                                    const ImageBuffer &soft_mask,
+                                    unsigned bpc,
+                                    unsigned channels,
+                                    unsigned image_width,
+                                    unsigned image_height,
+                                    unsigned width,
+                                    unsigned height,
+                                    unsigned colorspace = COLORSPACE_DEVICERGB,
+                                    bool flate = true,
+                                    const flate::CompressionPolicy *policy =
+                                      nullptr);
 
         // Add a custom object containing a stream. The return value is
         // analog to add_custom_object(). The second parameter specifies
         // if the stream must be deflated. The third argument lets the
         // user add some content to the stream header, which by default
-        // only contains the stream length.
+        // only contains the stream length. The last argument, if not null,
+        // replaces the compression policy of the document for this stream.
         unsigned add_custom_stream(const std::string &strm,
                                    const std::string &extra_header = std::string(),
-                                   bool flate = true);
+                                   bool flate = true,
+                                   const flate::CompressionPolicy *policy =
+                                     nullptr);
         unsigned add_custom_stream(const char *buffer,
                                    unsigned buffer_length,
                                    const char *extra_header,
                                    unsigned extra_headerLength,
-                                   bool flate);
+                                   bool flate,
+                                   const flate::CompressionPolicy *policy =
+                                     nullptr);
 
         unsigned add_custom_stream_from_file(const std::string &file_name,
                                              const std::string &extra_header,
-                                             bool flate = true);
+                                             bool flate = true,
+                                             const flate::CompressionPolicy
+                                               *policy = nullptr);
 
         // If a custom object is a page, it must be entered here to
         // refer to it in the page dictionaries.
@@ -259,13 +433,53 @@ class Document{
         std::ostream& write_xref(std::ostream &out_stream);
         std::ostream& write_trailer(std::ostream &out_stream);
 
+        // Write the cross-reference stream, which replaces the
+        // cross-reference table and the trailer in PDF 1.5.
+        std::ostream& write_xref_stream(std::ostream &out_stream);
+
+        // Write the pages using serialization_threads worker threads.
+        std::ostream& write_pages_in_parallel(std::ostream &out_stream);
+
+        // Write the objects pending in the writer in an object stream,
+        // which gets the next free object number.
+        void write_object_stream();
+
+        bool use_object_streams() const
+          { return output_profile == OutputProfile::PDF_1_5; }
+        // Write the first five objects of the document: the catalog, the
+        // outlines, the page tree, the page labels and the information
+        // dictionary.
+        std::ostream& write_structure(std::ostream &out_stream);
+
+        // Copy the bytes of the preamble, if any, to the output and record
+        // its objects in the writer.
+        void write_preamble(std::ostream &out_stream);
+
+        // The number of object numbers taken by the preamble.
+        unsigned preamble_objects() const
+          { return preamble ? preamble->get_object_count() : 0; }
+
+        // Write the body objects starting at the given index of the
+        // body_objects vector, numbering them consecutively from
+        // object_number. Returns the next free object number.
+        unsigned write_body_objects(std::ostream &out_stream,
+                                    size_t first_index,
+                                    unsigned object_number);
+
+
+        // When streaming, write a page to the stream preceded by the body
+        // objects not yet written, assigning object numbers to it starting
+        // from next_object_number.
+        void stream_page(std::ostream &out_stream, const PagePtr &page_ptr);
+
+        // Bind the document to the given stream and write the file header.
+        void bind_stream(std::ostream &out_stream);
+
     private:
-        // Each object has an offset in bytes from the start of the file.
-        // We will compute them as long as we output the document and its
-        // objects. This is not wrong because these offsets are only used
-        // in the cross-reference tables and we will need only one at the
-        // end of the document.
-        std::vector<std::streamoff> object_offsets;
+        // The writer sends the objects to the output and keeps, for each
+        // of them, the offset in bytes from the start of the file or its
+        // position in an object stream. It only exists while writing.
+        ObjectWriterPtr writer;
         // Usually zero, the position where the stream starts to be written.
         std::streamoff start_stream_position;
         // The offset of the cross-reference table, which is used in the
@@ -286,8 +500,53 @@ class Document{
         // The number of actual objects that all body objects need in order
         // to be written in the file.
         unsigned total_body_objects;
-        // The pages of the document.
+        // The pages of the document. It is empty when streaming, since
+        // pages are released as soon as they are written.
         std::vector<PagePtr> pages;
+        // The number of pages pushed back to the document.
+        unsigned page_count;
+        // The object numbers and labels of the written pages, used to write
+        // the page tree and the page labels.
+        std::vector<unsigned> page_object_numbers;
+        std::vector<std::string> page_labels;
+        // The stream the document is bound to when streaming, or null.
+        std::ostream *bound_stream;
+        // When the document is bound to a sink, or to a stream that cannot
+        // tell its position, it writes to an adapter stream.
+        SinkPtr adapter_sink;
+        std::shared_ptr<SinkStream> adapter_stream;
+        // When streaming, the number of body objects already written.
+        size_t streamed_body_objects;
+        // The output profile of the document.
+        OutputProfile output_profile;
+        // The number of threads used to write the pages.
+        unsigned serialization_threads;
+        // Whether page content streams are compressed by default.
+        bool content_flate;
+        // The compression policy of the objects without one of their own.
+        flate::CompressionPolicy compression_policy;
+        // An image numbered in the current output. The document does not
+        // keep the image and its soft mask alive, so that the pages
+        // written when streaming release their pixels. Once they are
+        // released, they are compared by their digests, which are only
+        // computed when streaming.
+        struct SharedImage
+        {
+          std::weak_ptr<Image> image;
+          std::weak_ptr<Image> soft_mask;
+          std::string digest;
+          unsigned object_number;
+        };
+        // The images numbered in the current output, by key.
+        bool image_deduplication;
+        std::unordered_multimap<std::string, SharedImage> shared_images;
+        // The resolution limit of page images, and how they are resampled.
+        double max_image_resolution;
+        resample::Filter image_resampling_filter;
+        // The counters returned by get_sampling_stats().
+        std::atomic<unsigned> sampled_payloads;
+        std::atomic<unsigned> stored_payloads;
+        std::atomic<std::uint64_t> stored_payload_bytes;
         // Document information.
         Info document_information;
         // Comments in the header of the document
@@ -300,8 +559,14 @@ class Document{
         // The map <image, colorspace> stores to which colorspace each
         // global image belongs.
         image_resource_map image_colorspaces;
+        // The preamble the body objects are written after, or null.
+        PreamblePtr preamble;
         // The optional content groups (OCG's) used in the document.
         std::vector<OcgPtr> ocgs;
+        // The threads compressing objects in the background, if any. It is
+        // the last member, so that its jobs finish before the members they
+        // use are destroyed.
+        ExecutorPtr compression_executor;
 };
 
 } // namespace paddlefish
@@ -0,0 +1,74 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef PADDLEFISH_EXECUTOR_H
+#define PADDLEFISH_EXECUTOR_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace paddlefish {
+
+class Executor;
+
+typedef std::unique_ptr<Executor> ExecutorPtr;
+
+// A fixed set of threads which run jobs in the background, in the order
+// they are submitted. The document uses it to compress objects while the
+// application keeps adding pages.
+class Executor
+{
+  public:
+    Executor(unsigned threads);
+
+    // Waits for the submitted jobs. Their errors are ignored.
+    ~Executor();
+
+    void submit(std::function<void()> job);
+
+    // Waits until all the submitted jobs have run. If any of them threw an
+    // exception, the first one is thrown again.
+    void wait();
+
+    unsigned get_threads() const { return (unsigned)workers.size(); }
+
+  private:
+    void run();
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()> > jobs;
+    std::mutex jobs_mutex;
+    std::condition_variable jobs_cv;
+    std::condition_variable done_cv;
+    // The jobs submitted and not finished yet, including the running ones.
+    size_t pending;
+    std::exception_ptr error;
+    bool stopping;
+};
+
+} // namespace paddlefish
+
+#endif // PADDLEFISH_EXECUTOR_H
+
+// vim: ts=2:sw=2:expandtab
@@ -18,6 +18,7 @@
 #ifndef PADDLEFISH_FILE_STREAM_H
 #define PADDLEFISH_FILE_STREAM_H
 
+#include "flate.h"
 #include "pdf_object.h"
 #include <string>
 #include <ostream>
@@ -35,7 +36,9 @@ public:
 
   FileStream(const std::string& filename,
              const std::string& extra_header = std::string(),
-             bool flate = false);
+             bool flate = false,
+             const flate::CompressionPolicy &policy =
+               flate::CompressionPolicy());
 
   ~FileStream() {}
 
@@ -47,27 +50,42 @@ public:
 
   Type get_type() const { return Type::FILE_STREAM; }
 
+  bool is_stream() const { return true; }
+
   std::ostream& to_stream(std::ostream& os) const;
 
-  const std::string get_contents() const;
+  void append_contents(std::string &buffer) const;
 
   std::ostream& length_to_stream(std::ostream& os) const;
 
+  // The length of the stream, known after writing it.
+  std::streamoff get_stream_length() const { return stream_length; }
+
+  // Whether the file was sampled when written, and the outcome.
+  flate::Sampling get_sampling() const { return sampling; }
+
 protected:
   // The file which will be copied to the stream.
   std::string filename;
 
-  // A string containing the object data, as it will be output to the PDF.
+  // The extra entries of the stream dictionary, as they will be output to
+  // the PDF.
   std::string header;
 
   // Use flate compression for object contents.
   bool use_flate;
 
+  // The parameters of the compression.
+  flate::CompressionPolicy compression_policy;
+
   unsigned object_number;
 
   // The length of the stream object. I did this mutable to compute when
   // writing to a stream, which is a const function.
   mutable std::streamoff stream_length;
+
+  // What the compression policy decided for the file, when written.
+  mutable flate::Sampling sampling;
 };
 
 } // namespace paddlefish
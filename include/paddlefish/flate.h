@@ -18,21 +18,142 @@
 #ifndef PADDLEFISH_FLATE_H
 #define PADDLEFISH_FLATE_H
 
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <ostream>
 
 namespace paddlefish {
 namespace flate{
 
+class CompressionCache;
+// Only defined when paddlefish is built with zlib.
+class Deflater;
+
+// The parameters used to deflate, as in deflateInit2() of the zlib manual.
+// The default is the best compression. Pixel data usually compresses
+// almost as well, and several times faster, with a level between 3 and 6
+// and the RLE or FILTERED strategies. Window bits must be in [9, 15],
+// since PDF readers expect a zlib stream.
+struct CompressionPolicy
+{
+  enum class Strategy:std::uint8_t
+  {
+    DEFAULT,
+    FILTERED,
+    HUFFMAN_ONLY,
+    RLE,
+    FIXED
+  };
+
+  // The library that compresses. DEFAULT is libdeflate for whole
+  // buffers, when paddlefish is built with it, and zlib (or zlib-ng) for
+  // the rest. ZLIB always uses zlib, whose output does not change between
+  // versions of paddlefish. Data compressed in pieces, like page contents
+  // or files, always uses zlib, since libdeflate only compresses whole
+  // buffers.
+  enum class Backend:std::uint8_t
+  {
+    DEFAULT,
+    ZLIB,
+    LIBDEFLATE
+  };
+
+  CompressionPolicy(int compression_level = 9,
+                    Strategy compression_strategy = Strategy::DEFAULT,
+                    int memory_level = 8,
+                    int bits = 15):
+    level(compression_level),
+    strategy(compression_strategy),
+    mem_level(memory_level),
+    window_bits(bits),
+    store_incompressible(false),
+    store_ratio(0.95),
+    threads(1),
+    backend(Backend::DEFAULT),
+    predictors(false),
+    ccitt_g4(false),
+    reduce_colors(false),
+    cache()
+  {}
+
+  // From 0 (no compression) to 9 (best compression).
+  int level;
+  Strategy strategy;
+  // From 1 (least memory) to 9 (fastest).
+  int mem_level;
+  int window_bits;
+  // Data which is usually compressed already (JPEG images, file streams
+  // and custom streams) may gain little from flate. If this is true, a
+  // leading sample of such data is deflated first, and when it does not
+  // shrink below store_ratio times its size, the data is stored without
+  // the flate filter.
+  bool store_incompressible;
+  double store_ratio;
+  // The number of threads used to deflate buffers bigger than
+  // PARALLEL_MIN_SIZE, such as big images or custom streams. Such a buffer
+  // is split in blocks which are deflated at the same time and joined in
+  // a single zlib stream, as pigz does. Zero means one thread per hardware
+  // thread. The output is slightly bigger than with a single thread, and
+  // not the same bytes.
+  unsigned threads;
+  Backend backend;
+  // If true, the rows of raw images and image resources with 8 or 16 bits
+  // per component are filtered with the PNG predictors before being
+  // deflated. Photographs, screenshots and gradients usually become much
+  // smaller.
+  bool predictors;
+  // If true, image masks and raw images with a single 1-bit component are
+  // compressed with CCITT Group 4 instead of flate. Scanned text pages are
+  // encoded many times faster and are usually smaller, but dithered
+  // pictures are much bigger than with flate.
+  bool ccitt_g4;
+  // If true, the colors of raw RGB images with 8 bits per component are
+  // counted when they are written. Images with at most 256 colors, like
+  // charts and screenshots, are written as indexed images with 1 to 8 bits
+  // per pixel, and gray images in DeviceRGB as DeviceGray.
+  bool reduce_colors;
+  // If not null, the data which is usually the same in every document,
+  // like fonts, color profiles and logos, is deflated only once and kept
+  // in this cache for the next documents; see CompressionCache.
+  std::shared_ptr<CompressionCache> cache;
+};
+
+// What store_incompressible decided for some data.
+enum class Sampling:std::uint8_t
+{
+  NONE,
+  DEFLATED,
+  STORED
+};
+
+// How many payloads were sampled because of store_incompressible, how many
+// of them were stored without compression, and their size.
+struct SamplingStats
+{
+  SamplingStats(): sampled(0), stored(0), stored_bytes(0) {}
+
+  unsigned sampled;
+  unsigned stored;
+  std::uint64_t stored_bytes;
+};
+
+// Whether paddlefish was built with the given backend, and its name.
+bool backend_available(CompressionPolicy::Backend backend);
+std::string backend_name(CompressionPolicy::Backend backend);
+
 #ifdef PADDLEFISH_USE_ZLIB
 
 // Deflate a string with zlib.
-std::string deflate_string(const std::string& str);
-std::string deflate_buffer(const char *buffer, unsigned length);
+std::string deflate_string(const std::string& str,
+                           const CompressionPolicy &policy = CompressionPolicy());
+std::string deflate_buffer(const char *buffer,
+                           unsigned length,
+                           const CompressionPolicy &policy = CompressionPolicy());
 
-// Inflate a string with zlib or, if it's not present, with puff. The
-// second parameter is the number of times the input size is allocated
-// to write the output.
+// Inflate a string with zlib. The second parameter is the number of times
+// the input size that is reserved for the output, which grows as needed.
 std::string inflate_string(const std::string&,unsigned=10);
 
 // Deflate the file and write it to the output stream. This can be done by
@@ -40,23 +161,157 @@ std::string inflate_string(const std::string&,unsigned=10);
 // string to the ostream. But that's slow, this function only uses a small
 // buffer as intermediate data structure and is thus faster.
 std::ostream& deflate_file_to_stream(std::ostream& out_stream,
-                                     const std::string& filename);
+                                     const std::string& filename,
+                                     const CompressionPolicy &policy =
+                                       CompressionPolicy());
 
 // Deflate a buffer and send it to the output stream. Same considerations
 // as for the above function.
 std::ostream& deflate_buffer_to_stream(std::ostream& out_stream,
                                        char *buffer,
-                                       unsigned length);
+                                       unsigned length,
+                                       const CompressionPolicy &policy =
+                                         CompressionPolicy());
 
 // Maximum bound for the bytes needed to deflate an input of a given size.
-unsigned deflate_bound(unsigned size);
+unsigned deflate_bound(unsigned size,
+                       const CompressionPolicy &policy = CompressionPolicy());
 
 // Deflate a given buffer. The destination buffer must have allocated
 // dstLenght bytes. Returns the actual number of bytes written in dst.
 unsigned deflate_buffer_to_buffer(const char *src,
                                   unsigned src_length,
                                   char *dst,
-                                  unsigned dst_length);
+                                  unsigned dst_length,
+                                  const CompressionPolicy &policy =
+                                    CompressionPolicy());
+
+// The number of bytes deflated by the functions below to decide whether
+// some data is worth deflating.
+const size_t SAMPLE_SIZE = 1 << 16;
+
+// Return false if the policy asks to store incompressible data and the
+// leading sample of the buffer does not compress well.
+bool worth_deflating(const char *data,
+                     size_t size,
+                     const CompressionPolicy &policy);
+// Same for the contents of a file. Return true if the file cannot be read,
+// so that the error is reported when the file is written.
+bool file_worth_deflating(const std::string &filename,
+                          const CompressionPolicy &policy);
+
+// The smallest input deflated in parallel, and the size of the blocks.
+const size_t PARALLEL_MIN_SIZE = 1 << 22;
+const size_t PARALLEL_BLOCK_SIZE = 1 << 17;
+
+// A reusable compression engine. The zlib state and the scratch buffers
+// are kept between calls, so compressing many small buffers (page
+// contents, object streams) does not allocate them every time. Inputs up
+// to SINGLE_PASS_LIMIT bytes are compressed with one call to zlib into a
+// buffer of deflateBound() bytes; bigger inputs are compressed through a
+// fixed ring of CHUNK_SIZE bytes, so that memory does not grow with them,
+// or in parallel blocks if the policy has several threads.
+class Deflater
+{
+  public:
+    static const size_t SINGLE_PASS_LIMIT = 1 << 20;
+    static const size_t CHUNK_SIZE = 1 << 16;
+
+    Deflater(const CompressionPolicy &policy = CompressionPolicy());
+    ~Deflater();
+
+    // Compress the buffer and append the result to the string. Return the
+    // number of compressed bytes.
+    size_t compress(const char *data, size_t size, std::string &out);
+    // Compress the buffer and write the result to the stream. Return the
+    // number of compressed bytes.
+    size_t compress(const char *data, size_t size, std::ostream &out);
+
+    // Compress data given in pieces: begin() starts a compressed stream
+    // written to the output stream, write() compresses a piece, and
+    // finish() ends the stream and returns its size in bytes.
+    void begin(std::ostream &out);
+    void write(const char *data, size_t size);
+    size_t finish();
+
+    const CompressionPolicy& get_policy() const;
+
+  private:
+    Deflater(const Deflater&) = delete;
+    Deflater& operator=(const Deflater&) = delete;
+
+    struct State;
+    std::unique_ptr<State> state;
+};
+
+// A deflater taken from the ones kept by the calling thread, and given
+// back to them when destroyed. Creating a deflater allocates and clears
+// the zlib state, about a quarter of a megabyte at the best compression;
+// reusing one only resets it. Each thread keeps a few deflaters, for the
+// policies used last.
+class PooledDeflater
+{
+  public:
+    PooledDeflater(const CompressionPolicy &policy = CompressionPolicy());
+    ~PooledDeflater();
+
+    Deflater& operator*() { return *deflater; }
+    Deflater* operator->() { return deflater.get(); }
+
+  private:
+    PooledDeflater(const PooledDeflater&) = delete;
+    PooledDeflater& operator=(const PooledDeflater&) = delete;
+
+    std::unique_ptr<Deflater> deflater;
+};
+
+// The number of allocations made by zlib so far, for all the threads.
+// Useful to check that the zlib state is reused.
+unsigned long zlib_allocations();
+
+// The reusable counterpart of Deflater, for decompression.
+class Inflater
+{
+  public:
+    Inflater();
+    ~Inflater();
+
+    // Decompress the buffer and append the result to the string. The
+    // expected size, if known, avoids growing the string. Return the
+    // number of decompressed bytes.
+    size_t decompress(const char *data,
+                      size_t size,
+                      std::string &out,
+                      size_t expected_size = 0);
+
+  private:
+    Inflater(const Inflater&) = delete;
+    Inflater& operator=(const Inflater&) = delete;
+
+    struct State;
+    std::unique_ptr<State> state;
+};
+
+// A deflater compresses the data given by successive calls to write() and
+// sends it to the output stream as it is produced, so that the whole input
+// never needs to be in memory. It uses a pooled deflater.
+class StreamDeflater
+{
+  public:
+    StreamDeflater(std::ostream &out_stream,
+                   const CompressionPolicy &policy = CompressionPolicy());
+    ~StreamDeflater();
+
+    void write(const char *data, size_t size);
+
+    // Finish the compressed stream and return its size in bytes.
+    size_t finish();
+
+  private:
+    PooledDeflater deflater;
+    bool finished;
+    size_t written;
+};
 
 #endif // PADDLEFISH_USE_ZLIB
 
@@ -64,12 +64,9 @@ public:
   // Set the object number of the CID to GID map.
   void set_map_ref(unsigned ref) { map_ref = ref; }
 
-  // Get a string containing the font object to write on the PDF. The
+  // Append the font object to write on the PDF to a buffer. The
   // references to widths and font descriptor must be set.
-  const std::string get_contents() const;
-
-  // Write the contents to a stream, same preconditions as get_contents().
-  std::ostream& to_stream(std::ostream &o) const { return o << get_contents(); }
+  void append_contents(std::string &buffer) const;
 
   Font::Type get_font_type() const { return type; }
 
@@ -56,12 +56,8 @@ class GraphicsState: public PdfObject
 
   Type get_type() const { return Type::GRAPHICS_STATE; }
 
-  // Write to stream the object representing the graphics state.
-  // The second argument is the object number.
-  std::ostream& to_stream(std::ostream &o) const { return o<<get_contents(); }
-
-  // Get the contents of the object in a string.
-  const std::string get_contents() const;
+  // Append the object representing the graphics state to a buffer.
+  void append_contents(std::string &buffer) const;
 
   // Returns a string containing the PDF commands needed to specify this
   // graphics state on the page.
@@ -19,12 +19,18 @@
 #define PADDLEFISH_IMAGE_H
 
 #include "colorspace_properties.h"
+#include "flate.h"
+#include "image_writer.h"
+#include "palette.h"
 #include "pdf_object.h"
+#include "png.h"
+#include "resample.h"
 #include <ostream>
 #include <cmath>
 #include <string>
 #include <cstdint>
 #include <memory>
+#include <vector>
 
 namespace paddlefish {
 
@@ -32,6 +38,12 @@ class Image;
 
 typedef std::shared_ptr<Image> ImagePtr;
 
+// The pixels of a raw image. The image keeps a reference to the buffer until
+// it is destroyed, and reads it only when the document is written. The
+// deleter of the pointer releases the buffer: it can free memory owned by
+// the image, or call back the owner of a borrowed buffer.
+typedef std::shared_ptr<const unsigned char> ImageBuffer;
+
 // This class represents an image. For the moment, we only support JPEG.
 class Image: public PdfObject
 {
@@ -40,6 +52,7 @@ class Image: public PdfObject
           JPEG,
           RAW,
           IMAGE_MASK,
+          PNG,
           OTHER
         };
 
@@ -64,6 +77,40 @@ class Image: public PdfObject
               unsigned cs = COLORSPACE_DEVICERGB,
               bool flate = true);
 
+        // These constructors take the contents of a JPEG file in memory,
+        // which are pasted in the output like the contents of a file. The
+        // size, components and colorspace of the image are read from its
+        // markers. They throw std::runtime_error if the buffer is not a
+        // JPEG image that can be embedded.
+        Image(const ImageBuffer &jpeg_bytes,
+              size_t jpeg_size,
+              double x_pos,
+              double y_pos,
+              double print_width,
+              double print_height,
+              bool flate = true);
+
+        Image(const ImageBuffer &jpeg_bytes,
+              size_t jpeg_size,
+              double *matrix23,
+              bool flate = true);
+
+        // These constructors take the contents of a PNG file in memory,
+        // with the properties png::read_info() read from them. The data of
+        // the image is written as it is, without being inflated: its rows
+        // are already filtered as /Predictor 15 expects. The buffer is kept
+        // when the data is a single chunk, and copied otherwise.
+        Image(const ImageBuffer &png_bytes,
+              const png::PngInfo &info,
+              double x_pos,
+              double y_pos,
+              double print_width,
+              double print_height);
+
+        Image(const ImageBuffer &png_bytes,
+              const png::PngInfo &info,
+              double *matrix23);
+
         // This constructor accepts the bytes of the image in raw format.
         // Each pixel must be defined using 8 bits per channel, in RGBA
         // order.
@@ -92,6 +139,43 @@ class Image: public PdfObject
               unsigned cs = COLORSPACE_DEVICERGB,
               bool flate = true);
 
+        // These constructors are analogous to the two above, but they do
+        // not copy the pixels: the image keeps the given buffer, which must
+        // not be modified until the document is written.
+        Image(const ImageBuffer &raw_bytes,
+              bool uses_soft_mask,
+              unsigned bits_per_component,
+              unsigned number_of_channels,
+              unsigned image_width,
+              unsigned image_height,
+              double x_pos,
+              double y_pos,
+              double width,
+              double height,
+              unsigned cs = COLORSPACE_DEVICERGB,
+              bool flate = true);
+
+        Image(const ImageBuffer &raw_bytes,
+              bool uses_soft_mask,
+              unsigned bits_per_component,
+              unsigned number_of_channels,
+              unsigned image_width,
+              unsigned image_height,
+              double *matrix23,
+              unsigned cs = COLORSPACE_DEVICERGB,
+              bool flate = true);
+
+        // These constructors take an image built row by row. The writer
+        // must be finished before the document is written. Its data is
+        // already compressed, so the compression policies do not apply.
+        Image(const ImageWriterPtr &image_writer,
+              double x_pos,
+              double y_pos,
+              double width,
+              double height);
+
+        Image(const ImageWriterPtr &image_writer, double *matrix23);
+
         // Constructor for an image mask. Each line in *mask_bytes must
         // use a number of bytes which is multiple of 8. If the width is
         // not multiple of eight, then some bits must be added to the row.
@@ -104,20 +188,57 @@ class Image: public PdfObject
 
         ~Image() {};
 
-        std::ostream& to_stream(std::ostream &o) const { return o << get_contents(); }
-
-        const std::string get_contents() const;
+        void append_contents(std::string &buffer) const;
 
         // Write to stream the object representing the image. It adds a
         // reference to the next object in the file, containing stream
         // length. Returns the length of the stream, needed to write the
-        // next object.
-        unsigned write_image(std::ostream&,unsigned)const;
+        // next object; it can exceed 4 GB for images from a writer. The
+        // image is compressed, if needed, with its own compression policy
+        // or, if it has none, with the given one. If the policy made a JPEG
+        // image be sampled, the outcome is stored in the last parameter,
+        // when given.
+        std::uint64_t write_image(std::ostream&,
+                                  unsigned,
+                                  const flate::CompressionPolicy&,
+                                  flate::Sampling* = nullptr)const;
         // Write the file contents to stream. Return the number of written
         // bytes.
-        unsigned write_image_stream(std::ostream&)const;
+        std::uint64_t write_image_stream(std::ostream&,
+                                         const flate::CompressionPolicy&,
+                                         bool deflate_data)const;
+        // Set the compression policy of this image. A null pointer means
+        // the policy of the document.
+        void set_compression_policy(
+            const std::shared_ptr<const flate::CompressionPolicy> &p)
+          { policy = p; }
+        // Resample the pixels of a raw image with 8 bits per component, if
+        // needed, so that its resolution at the size it is drawn does not
+        // exceed the given dots per inch. Returns true if the image was
+        // resampled. The samples are blended, so the caller must not call
+        // it for images in an indexed colorspace.
+        bool limit_resolution(double max_dpi, resample::Filter filter);
         // Set the object number of the image in the document.
         void set_object_number(unsigned);
+        // Whether the image is only referenced by the page, because an
+        // identical image was already written to the document.
+        void set_shared(bool s) { shared = s; }
+        bool is_shared()const { return shared; }
+        // Returns a string that is equal for two images which are written
+        // the same way. The contents of raw images are represented by their
+        // hash, and the contents of JPEG files by the file name. The hash
+        // is computed on each call, so that images are only read when they
+        // are deduplicated.
+        std::string get_key()const;
+        // Returns true if the contents of both images are the same. Together
+        // with equal keys, this means that one image can replace the other.
+        bool same_contents(const Image &other)const;
+        // Returns a string that is equal for two images with the same
+        // contents, which can be compared once the images are released:
+        // the SHA-256 digest of the pixels or the bytes, or the name of
+        // the JPEG file. It is empty for images given by an ImageWriter,
+        // whose contents cannot be compared that way.
+        std::string get_digest()const;
         // Get the object number.
         unsigned get_object_number()const { return image_object_number; }
         // Get a string containing the filters needed to read the stream.
@@ -140,8 +261,37 @@ class Image: public PdfObject
         bool has_soft_mask()const { return use_soft_mask; }
     private:
         void fill_bytes(const unsigned char *source);
-        unsigned write_file_contents(std::ostream&)const;
-        unsigned write_bytes(std::ostream&)const;
+        void set_raw_size();
+        void set_jpeg(const ImageBuffer &jpeg_bytes, size_t jpeg_size);
+        void set_png(const ImageBuffer &png_bytes, const png::PngInfo &info);
+        void set_writer(const ImageWriterPtr &image_writer);
+        std::string get_image_filters(bool deflate_data)const;
+        // Whether the rows are filtered with the PNG predictors.
+        bool uses_predictors(const flate::CompressionPolicy&)const;
+        // Whether the image is compressed with CCITT Group 4.
+        bool uses_ccitt(const flate::CompressionPolicy&)const;
+        // Whether the colors of the image are counted to reduce it.
+        bool uses_reduction(const flate::CompressionPolicy&)const;
+        unsigned write_file_contents(std::ostream&,
+                                     const flate::CompressionPolicy&,
+                                     bool deflate_data)const;
+        unsigned write_bytes(std::ostream&,
+                             const flate::CompressionPolicy&,
+                             bool deflate_data)const;
+        unsigned write_reduced(std::ostream&,
+                               const flate::CompressionPolicy&,
+                               bool deflate_data,
+                               const palette::Reduction&)const;
+        // Write the given pixels, deflated if needed, and filtered with the
+        // predictors if predict is true.
+        unsigned write_pixels(std::ostream&,
+                              const flate::CompressionPolicy&,
+                              bool deflate_data,
+                              const unsigned char *data,
+                              unsigned size,
+                              size_t row_size,
+                              unsigned pixel_size,
+                              bool predict)const;
     private:
         std::shared_ptr<const unsigned char> bytes;
         unsigned bytes_size;
@@ -158,6 +308,17 @@ class Image: public PdfObject
         unsigned *decode;
         bool use_flate;
         bool use_soft_mask;
+        // Whether the components are decoded inverted, as in the CMYK JPEG
+        // images written by Adobe applications.
+        bool inverted;
+        // The palette of an indexed PNG image, and the colors masked by its
+        // transparency, if any.
+        std::string palette;
+        std::vector<unsigned> color_key;
+        // The writer which built the image, if any.
+        ImageWriterPtr writer;
+        bool shared;
+        std::shared_ptr<const flate::CompressionPolicy> policy;
 };
 
 } // namespace paddlefish
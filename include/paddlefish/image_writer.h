@@ -0,0 +1,124 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef PADDLEFISH_IMAGE_WRITER_H
+#define PADDLEFISH_IMAGE_WRITER_H
+
+#include "colorspace_properties.h"
+#include "flate.h"
+#include "sink.h"
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace paddlefish {
+
+class ImageWriter;
+
+typedef std::shared_ptr<ImageWriter> ImageWriterPtr;
+
+// Builds a raw image from its rows, given a few at a time, so that images
+// too big for the memory never have to be in it. The rows are filtered
+// with the PNG predictors, if the policy asks for them, and deflated as
+// they come. The result is kept in a temporary file, or in memory, and
+// copied to the output when the document is written. The image is added
+// to pages with Page::add_image_writer().
+class ImageWriter
+{
+  public:
+    // Where the image data is kept until the document is written.
+    enum class Spill:std::uint8_t
+    {
+      FILE,
+      MEMORY
+    };
+
+    ImageWriter(unsigned image_width,
+                unsigned image_height,
+                unsigned bits_per_component,
+                unsigned number_of_channels,
+                unsigned cs = COLORSPACE_DEVICERGB,
+                bool flate = true,
+                const flate::CompressionPolicy &policy =
+                  flate::CompressionPolicy(),
+                Spill spill = Spill::FILE);
+    ~ImageWriter();
+
+    // Append rows to the image, each of them get_stride() bytes long.
+    // Throws std::runtime_error if the image gets more rows than its
+    // height, or if it is finished.
+    void write_rows(const unsigned char *rows, size_t count);
+
+    // Ends the image. All its rows must have been written.
+    void finish();
+    bool is_finished() const { return finished; }
+
+    // Copy the image data to the stream. Return the number of bytes.
+    std::uint64_t copy_to(std::ostream &o) const;
+
+    size_t get_stride() const { return stride; }
+    unsigned get_image_width() const { return width; }
+    unsigned get_image_height() const { return height; }
+    unsigned get_bits_per_component() const { return bpc; }
+    unsigned get_number_of_channels() const { return channels; }
+    unsigned get_colorspace() const { return colorspace; }
+    bool uses_flate() const { return use_flate; }
+    bool uses_predictors() const { return use_predictors; }
+
+  private:
+    ImageWriter(const ImageWriter&) = delete;
+    ImageWriter& operator=(const ImageWriter&) = delete;
+
+    unsigned width;
+    unsigned height;
+    unsigned bpc;
+    unsigned channels;
+    unsigned colorspace;
+    bool use_flate;
+    bool use_predictors;
+    size_t stride;
+    unsigned rows_written;
+    bool finished;
+    // The image data: a temporary file written through a sink, or a
+    // string.
+    std::FILE *spill_file;
+    std::unique_ptr<Sink> spill_sink;
+    std::unique_ptr<std::ostream> spill_stream;
+    std::string spill_memory;
+    std::uint64_t spill_size;
+    // Copies from several threads read the file one after the other.
+    mutable std::mutex spill_mutex;
+    // The deflater of the rows, while they are written. It is declared
+    // even without zlib, so that the layout of the class does not depend
+    // on how the library was built; a shared pointer can be destroyed
+    // where the deflater is not defined.
+    std::shared_ptr<flate::Deflater> deflater;
+    // The last row given, needed by the predictors of the next one, and
+    // the filtered rows, which are reused between calls.
+    std::vector<unsigned char> previous_row;
+    std::string filtered;
+};
+
+} // namespace paddlefish
+
+#endif // PADDLEFISH_IMAGE_WRITER_H
+
+// vim: ts=2:sw=2:expandtab
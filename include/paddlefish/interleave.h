@@ -0,0 +1,65 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef PADDLEFISH_INTERLEAVE_H
+#define PADDLEFISH_INTERLEAVE_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace paddlefish {
+namespace interleave {
+
+// The order of the components of a pixel with alpha, as they are in
+// memory. In the premultiplied formats the color components are already
+// multiplied by the alpha, as most renderers keep them; note that the
+// ARGB32 pixels of Cairo and the like are BGRA_PREMULTIPLIED in memory on
+// little endian machines.
+enum class PixelFormat:std::uint8_t
+{
+  RGBA,
+  BGRA,
+  ARGB,
+  RGBA_PREMULTIPLIED,
+  BGRA_PREMULTIPLIED,
+  ARGB_PREMULTIPLIED
+};
+
+// Split pixels with alpha into RGB pixels and their alpha, which are what
+// an image and its soft mask take. The rows of the input have stride
+// bytes; the outputs have no padding. Components have 8 or 16 bits; 16-bit
+// components are read in the byte order of the machine and written big
+// endian, as PDF expects. Premultiplied colors are divided by their alpha.
+// Returns false if every pixel is opaque, so that the alpha is not needed.
+// With 8-bit components and a compiler targeting SSSE3, four pixels are
+// split at once with byte shuffles, unless they are premultiplied and not
+// opaque.
+bool split(const unsigned char *data,
+           size_t stride,
+           unsigned width,
+           unsigned height,
+           unsigned bpc,
+           PixelFormat format,
+           unsigned char *color,
+           unsigned char *alpha);
+
+} // namespace interleave
+} // namespace paddlefish
+
+#endif // PADDLEFISH_INTERLEAVE_H
+
+// vim: ts=2:sw=2:expandtab
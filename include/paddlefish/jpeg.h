@@ -0,0 +1,72 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef PADDLEFISH_JPEG_H
+#define PADDLEFISH_JPEG_H
+
+#include <cstddef>
+#include <memory>
+
+namespace paddlefish {
+namespace jpeg {
+
+// The properties of a JPEG image which are needed to embed it in a PDF.
+struct JpegInfo
+{
+  JpegInfo():
+    width(0),
+    height(0),
+    components(0),
+    bits_per_component(0),
+    adobe(false),
+    adobe_transform(0)
+  {}
+
+  unsigned width;
+  unsigned height;
+  unsigned components;
+  unsigned bits_per_component;
+  // Whether the image has an Adobe APP14 marker, and its color transform.
+  bool adobe;
+  unsigned adobe_transform;
+};
+
+// Reads the markers of a JPEG image up to its frame header (SOF), which
+// gives the size and the number of components. An APP14 marker written by
+// Adobe before it is also read. Throws std::runtime_error when the data is
+// not a JPEG image, is truncated before the frame header, or cannot be
+// embedded in a PDF.
+JpegInfo read_info(const unsigned char *data, size_t size);
+
+// Returns the device colorspace of the image, according to its components.
+unsigned colorspace(const JpegInfo &info);
+
+// Adobe applications write four-component images with inverted values,
+// which must be decoded with an inverted decode array.
+bool is_inverted(const JpegInfo &info);
+
+// Reads a file from an open descriptor, from its current position to the
+// end. The descriptor is not closed. The size of the contents is stored
+// in the last parameter.
+std::shared_ptr<const unsigned char> read_descriptor(int fd, size_t &size);
+
+} // namespace jpeg
+} // namespace paddlefish
+
+#endif // PADDLEFISH_JPEG_H
+
+// vim: ts=2:sw=2:expandtab
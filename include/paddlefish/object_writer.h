@@ -0,0 +1,115 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef PADDLEFISH_OBJECT_WRITER_H
+#define PADDLEFISH_OBJECT_WRITER_H
+
+#include "flate.h"
+
+#include <cstdint>
+#include <ios>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace paddlefish {
+
+class ObjectWriter;
+
+typedef std::shared_ptr<ObjectWriter> ObjectWriterPtr;
+
+// The information the cross-reference needs about an object: either its
+// offset in the output or, for objects packed in an object stream, the
+// number of that stream and the index of the object in it.
+struct XrefEntry
+{
+  enum class Type:std::uint8_t
+  {
+    FREE,
+    OFFSET,
+    COMPRESSED
+  };
+
+  Type type = Type::FREE;
+  std::streamoff offset = 0;
+  unsigned stream_number = 0;
+  unsigned index = 0;
+};
+
+// An object writer sends indirect objects to an output stream and keeps
+// the cross-reference entry of each of them. When object streams are
+// used, non-stream objects are not written right away; they are kept
+// until write_object_stream() packs them in an object stream.
+class ObjectWriter
+{
+  public:
+    ObjectWriter(std::ostream &out_stream, bool use_object_streams = false);
+    ~ObjectWriter() {}
+
+    std::ostream& get_stream() { return out; }
+
+    // Record the current position of the output as the offset of the given
+    // object. The caller must write the object right after this call.
+    void mark_object(unsigned object_number);
+
+    // Write a non-stream object. The contents must not include the
+    // "n 0 obj" and "endobj" keywords.
+    void write_object(unsigned object_number, const std::string &contents);
+
+    // Number of objects waiting to be packed in an object stream, and
+    // whether they are enough to fill one.
+    size_t pending_objects() const { return pending.size(); }
+    bool object_stream_full() const;
+
+    // Write the pending objects in an object stream with the given number,
+    // compressed with the given policy.
+    void write_object_stream(unsigned object_number,
+                             const flate::CompressionPolicy &policy);
+
+    // Take over the objects of another writer, whose output was copied to
+    // the output of this one starting at offset base. The offsets of the
+    // other writer are relative to the start of its own output, so they
+    // are relocated, and its pending objects are appended to ours.
+    void append(ObjectWriter &other, std::streamoff base);
+
+    // Take over the given cross-reference entries, of objects already
+    // written and copied to the output starting at offset base.
+    void add_entries(const std::vector<XrefEntry> &other_entries,
+                     std::streamoff base);
+
+    bool uses_object_streams() const { return use_object_streams; }
+
+    // The cross-reference entries, indexed by object number.
+    const std::vector<XrefEntry>& get_entries() const { return entries; }
+
+  private:
+    XrefEntry& entry(unsigned object_number);
+
+    std::ostream &out;
+    bool use_object_streams;
+    std::vector<XrefEntry> entries;
+    // The object numbers and contents of the objects not written yet.
+    std::vector<std::pair<unsigned, std::string> > pending;
+};
+
+} // namespace paddlefish
+
+#endif // PADDLEFISH_OBJECT_WRITER_H
+
+// vim: ts=2:sw=2:expandtab
@@ -23,8 +23,10 @@
 #include "text.h"
 #include "text_state.h"
 #include "image.h"
+#include "interleave.h"
 #include "graphics_state.h"
 #include "ocg.h"
+#include "object_writer.h"
 #include "resources_dict.h"
 #include <ostream>
 #include <vector>
@@ -75,6 +77,59 @@ class Page{
                             double *matrix23,
                             unsigned cs = COLORSPACE_DEVICERGB);
 
+        // Adds a JPEG image given the contents of the file in memory. The
+        // size of the image, its components and its colorspace are read
+        // from its markers. The buffer is not copied; see ImageBuffer.
+        void add_jpeg_buffer(const ImageBuffer &jpeg,
+                             size_t jpeg_size,
+                             double x_pos,
+                             double y_pos,
+                             double width,
+                             double height);
+
+        void add_jpeg_buffer(const ImageBuffer &jpeg,
+                             size_t jpeg_size,
+                             double *matrix23);
+
+        // Adds a JPEG image read from an open file descriptor, from its
+        // current position to the end, as add_jpeg_buffer() does. The
+        // descriptor is read before returning, and it is not closed.
+        void add_jpeg_descriptor(int fd,
+                                 double x_pos,
+                                 double y_pos,
+                                 double width,
+                                 double height);
+
+        void add_jpeg_descriptor(int fd, double *matrix23);
+
+        // Adds a PNG image given the contents of the file in memory. Its
+        // compressed data is embedded without being decoded, with its
+        // palette and its transparent color, if any. Throws
+        // std::runtime_error for images which must be decoded: interlaced
+        // images, and images with alpha; see png::read_info(). The buffer
+        // is not copied when the data is a single chunk; see ImageBuffer.
+        void add_png_buffer(const ImageBuffer &png,
+                            size_t png_size,
+                            double x_pos,
+                            double y_pos,
+                            double width,
+                            double height);
+
+        void add_png_buffer(const ImageBuffer &png,
+                            size_t png_size,
+                            double *matrix23);
+
+        // Adds a PNG image read from an open file descriptor, from its
+        // current position to the end, as add_png_buffer() does. The
+        // descriptor is read before returning, and it is not closed.
+        void add_png_descriptor(int fd,
+                                double x_pos,
+                                double y_pos,
+                                double width,
+                                double height);
+
+        void add_png_descriptor(int fd, double *matrix23);
+
         // Adds an image given its bytes, size and position.
         void add_image_bytes(const unsigned char *bytes,
                              const unsigned char *soft_mask, // can be NULL
@@ -100,6 +155,74 @@ class Page{
                              unsigned cs = COLORSPACE_DEVICERGB,
                              bool flate = true);
 
+        // Adds an image given a buffer with its bytes, size and position.
+        // The pixels are not copied: the image takes a reference to the
+        // buffers, which are read when the document is written and released
+        // by their deleters when the document no longer needs them. To lend
+        // a buffer, give it a deleter which notifies its owner.
+        void add_image_buffer(const ImageBuffer &bytes,
+                              const ImageBuffer &soft_mask, // can be null
+                              unsigned bpp,
+                              unsigned channels,
+                              unsigned image_width,
+                              unsigned image_height,
+                              double x_pos,
+                              double y_pos,
+                              double width,
+                              double height,
+                              unsigned cs = COLORSPACE_DEVICERGB,
+                              bool flate = true);
+
+        // Adds an image given a buffer with its bytes and matrix.
+        void add_image_buffer(const ImageBuffer &bytes,
+                              const ImageBuffer &soft_mask, // can be null
+                              unsigned bpp,
+                              unsigned channels,
+                              unsigned image_width,
+                              unsigned image_height,
+                              double *matrix23,
+                              unsigned cs = COLORSPACE_DEVICERGB,
+                              bool flate = true);
+
+        // Adds an image given its pixels interleaved with their alpha, as
+        // renderers produce them, with 8 or 16 bits per component. The
+        // pixels are split into an RGB image and its soft mask, which is
+        // left out when all the pixels are opaque; see interleave::split().
+        // The rows of the pixels have stride bytes.
+        void add_image_interleaved(const unsigned char *pixels,
+                                   size_t stride,
+                                   interleave::PixelFormat format,
+                                   unsigned bpc,
+                                   unsigned image_width,
+                                   unsigned image_height,
+                                   double x_pos,
+                                   double y_pos,
+                                   double width,
+                                   double height,
+                                   bool flate = true);
+
+        // Adds an image given its interleaved pixels and matrix.
+        void add_image_interleaved(const unsigned char *pixels,
+                                   size_t stride,
+                                   interleave::PixelFormat format,
+                                   unsigned bpc,
+                                   unsigned image_width,
+                                   unsigned image_height,
+                                   double *matrix23,
+                                   bool flate = true);
+
+        // Adds an image built row by row, given its position and size. The
+        // writer must be finished before the document is written; see
+        // ImageWriter.
+        void add_image_writer(const ImageWriterPtr &writer,
+                              double x_pos,
+                              double y_pos,
+                              double width,
+                              double height);
+
+        // Adds an image built row by row, given its matrix.
+        void add_image_writer(const ImageWriterPtr &writer, double *matrix23);
+
         // Adds an image mask to the document.
         void add_image_mask(const unsigned char *bytes,
                             unsigned image_width,
@@ -108,6 +231,12 @@ class Page{
                             unsigned *decode,
                             bool flate = true);
 
+        // Set the compression policy of the images added to the page from
+        // now on. By default, images use the policy of the document.
+        void set_image_compression_policy(const flate::CompressionPolicy &p)
+          { image_policy.reset(new flate::CompressionPolicy(p)); }
+        void clear_image_compression_policy() { image_policy.reset(); }
+
         // Adds a PDF command to the page.
         void add_command(const std::string &command);
 
@@ -140,12 +269,9 @@ class Page{
         template <class T>
         void add_text(double *matrix23, const T &chars, bool map = false);
 
-        // This function sends the page to a stream. Its second parameter
-        // is a back insert iterator to a vector storing the offsets to the
-        // beginning of the stream.
-        std::ostream& to_stream(
-                std::ostream &out_stream,
-                std::back_insert_iterator<std::vector<std::streamoff> > inserter);
+        // This function sends the page and its objects to the stream of
+        // the given object writer, which keeps their offsets.
+        std::ostream& to_stream(ObjectWriter &writer);
 
         // Get and set the page number and label.
         unsigned get_number() const { return page_number; }
@@ -153,6 +279,18 @@ class Page{
         std::string get_label() const { return page_label; }
         void set_label(const std::string &label) { page_label = label; }
 
+        // Whether the content stream of the page is compressed with flate:
+        // as set in the document, which is the default, or always or never
+        // for this page.
+        enum class ContentFlate:std::uint8_t
+        {
+          DOCUMENT,
+          ALWAYS,
+          NEVER
+        };
+        void set_content_flate(ContentFlate flate) { content_flate = flate; }
+        ContentFlate get_content_flate() const { return content_flate; }
+
         // Sets the media box of the page.
         void set_mediabox(double x_start,
                           double y_start,
@@ -217,6 +355,9 @@ class Page{
           { rdict->add_font(font_id); }
 
     private:
+        // Add an image to the page objects.
+        void add_image(const ImagePtr &image);
+
         // Given the object number of a colorspace used on this page,
         // update the booleans containing the image types used.
         void set_image_color_information(unsigned cs_id);
@@ -258,6 +399,12 @@ class Page{
         bool has_text;
         unsigned images_count;
 
+        // Whether the content stream is compressed.
+        ContentFlate content_flate;
+
+        // The compression policy of the images added from now on, or null.
+        std::shared_ptr<const flate::CompressionPolicy> image_policy;
+
         // The resources dictionary contains the font, colorspace, pattern,
         // graphic state, shading and image resources of the page.
         ResourcesDictPtr rdict = ResourcesDictPtr(new ResourcesDict());
@@ -0,0 +1,76 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef PADDLEFISH_PALETTE_H
+#define PADDLEFISH_PALETTE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace paddlefish {
+namespace palette {
+
+// How the pixels of an RGB image with 8 bits per component can be written
+// with fewer bytes, without losing anything.
+struct Reduction
+{
+  enum class Type:std::uint8_t
+  {
+    // The image has too many colors.
+    NONE,
+    // All the pixels are neutral, with many levels of gray.
+    GRAY,
+    // The image has at most 256 colors, which are indexed.
+    INDEXED
+  };
+
+  Reduction(): type(Type::NONE), bits_per_component(8) {}
+
+  Type type;
+  // The bits per component of the reduced image.
+  unsigned bits_per_component;
+  // The RGB components of the colors of an indexed image, sorted.
+  std::string colors;
+};
+
+// Find the colors of an image with three 8-bit components, which has rows
+// of stride bytes. The scan stops as soon as there are more than 256
+// colors. Images with 16 colors or less are indexed with 1, 2 or 4 bits per
+// pixel. Otherwise, neutral images become gray if gray is true, and the
+// others are indexed with 8 bits per pixel.
+Reduction analyze(const unsigned char *data,
+                  size_t stride,
+                  unsigned width,
+                  unsigned height,
+                  bool gray);
+
+// Append the rows of the image reduced as analyze() said. Each row starts
+// at a byte boundary.
+void reduce(const unsigned char *data,
+            size_t stride,
+            unsigned width,
+            unsigned height,
+            const Reduction &reduction,
+            std::string &out);
+
+} // namespace palette
+} // namespace paddlefish
+
+#endif // PADDLEFISH_PALETTE_H
+
+// vim: ts=2:sw=2:expandtab
@@ -20,6 +20,7 @@
 
 #include <ostream>
 #include <memory>
+#include <string>
 
 namespace paddlefish {
 
@@ -40,9 +41,30 @@ struct PdfObject
 
   virtual Type get_type() const { return Type::UNKNOWN; }
 
-  virtual std::ostream& to_stream(std::ostream &o) const = 0;
+  // Whether the object is a stream. Streams cannot be packed in object
+  // streams.
+  virtual bool is_stream() const { return false; }
 
-  virtual const std::string get_contents() const = 0;
+  // Append the contents of the object to a buffer. This is how objects
+  // are serialized: the caller reuses the buffer, so that no temporary
+  // strings are built for each object.
+  virtual void append_contents(std::string &buffer) const = 0;
+
+  // Write the contents to a stream.
+  virtual std::ostream& to_stream(std::ostream &o) const
+  {
+    std::string buffer;
+    append_contents(buffer);
+    return o.write(buffer.data(), buffer.size());
+  }
+
+  // The contents of the object, in a new string.
+  const std::string get_contents() const
+  {
+    std::string buffer;
+    append_contents(buffer);
+    return buffer;
+  }
 
   virtual ~PdfObject() {}
 };
@@ -0,0 +1,77 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef PADDLEFISH_PNG_H
+#define PADDLEFISH_PNG_H
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace paddlefish {
+namespace png {
+
+// The properties of a PNG image which are needed to embed it in a PDF.
+// Its compressed data is the same zlib stream that FlateDecode reads, and
+// its rows are filtered the same way as with /Predictor 15, so the data is
+// copied without being inflated.
+struct PngInfo
+{
+  PngInfo():
+    width(0),
+    height(0),
+    bit_depth(0),
+    color_type(0)
+  {}
+
+  unsigned width;
+  unsigned height;
+  unsigned bit_depth;
+  unsigned color_type;
+  // The RGB triples of the palette of an indexed image.
+  std::string palette;
+  // The ranges of the components, or of the indices, of the transparent
+  // colors given by the tRNS chunk, as a /Mask array takes them.
+  std::vector<unsigned> color_key;
+  // The offset and the length of each IDAT chunk; their data together is
+  // the zlib stream.
+  std::vector<std::pair<size_t, size_t> > data;
+};
+
+// Reads the chunks of a PNG image up to its IEND chunk. Throws
+// std::runtime_error when the data is not a PNG image, is truncated, or
+// cannot be embedded without decoding it: interlaced images, images with
+// an alpha channel, and indexed images with partially transparent colors,
+// or with transparent colors whose indices are not consecutive. The CRCs
+// of the chunks are not checked.
+PngInfo read_info(const unsigned char *data, size_t size);
+
+// The number of components of each pixel in the image data, which is one
+// for indexed images.
+unsigned components(const PngInfo &info);
+
+// Returns the device colorspace of the image, which is the base colorspace
+// of indexed images.
+unsigned colorspace(const PngInfo &info);
+
+} // namespace png
+} // namespace paddlefish
+
+#endif // PADDLEFISH_PNG_H
+
+// vim: ts=2:sw=2:expandtab
@@ -0,0 +1,84 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef PADDLEFISH_PREAMBLE_H
+#define PADDLEFISH_PREAMBLE_H
+
+#include "colorspace_properties.h"
+#include "object_writer.h"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace paddlefish {
+
+class Document;
+class Preamble;
+
+typedef std::shared_ptr<const Preamble> PreamblePtr;
+
+// A preamble holds the body objects of a document (fonts, color profiles,
+// functions, shadings, patterns, custom objects and so on) already written
+// to bytes, numbered from object 6 on. It is built by
+// Document::freeze_preamble() and never changes afterwards, so any number
+// of documents, on any threads, can be created from it. Those documents
+// copy the bytes to their output instead of writing the objects again, and
+// number their own objects after the ones of the preamble.
+class Preamble
+{
+  public:
+    ~Preamble() {}
+
+    // The written objects, and the cross-reference entries of each of them
+    // indexed by object number, with offsets relative to the bytes.
+    const std::string& get_bytes() const { return bytes; }
+    const std::vector<XrefEntry>& get_entries() const { return entries; }
+
+    // The number of object numbers the preamble takes, from 6 on. It
+    // includes the numbers of the object streams, if any.
+    unsigned get_object_count() const { return object_count; }
+
+    // Whether the objects are packed in object streams, that is, whether
+    // the preamble was written with the PDF 1.5 output profile.
+    bool uses_object_streams() const { return object_streams; }
+
+  private:
+    friend class Document;
+
+    Preamble(): object_count(0), object_streams(false) {}
+
+    std::string bytes;
+    std::vector<XrefEntry> entries;
+    unsigned object_count;
+    bool object_streams;
+    // What the document needs to know about the objects without writing
+    // them again: the colorspaces, the colorspaces of the image
+    // resources, the object numbers of the standard fonts, by name, and
+    // the custom objects which are pages.
+    std::unordered_map<unsigned, ColorspaceProperties> colorspace_properties;
+    std::unordered_map<unsigned, unsigned> image_colorspaces;
+    std::unordered_map<std::string, unsigned> standard_fonts;
+    std::vector<unsigned> custom_object_page_numbers;
+};
+
+} // namespace paddlefish
+
+#endif // PADDLEFISH_PREAMBLE_H
+
+// vim: ts=2:sw=2:expandtab
@@ -0,0 +1,51 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef PADDLEFISH_PREDICTOR_H
+#define PADDLEFISH_PREDICTOR_H
+
+#include <cstddef>
+#include <string>
+
+namespace paddlefish {
+namespace predictor {
+
+// Filter the rows of an image with the PNG predictors, so that it deflates
+// better. For each row, the filter (None, Sub, Up, Average or Paeth) whose
+// output has the smallest sum of absolute values is chosen, as libpng does,
+// and written before the filtered row, as /Predictor 15 expects. The rows
+// have stride bytes each; bytes_per_pixel is the number of bytes of a
+// pixel, or 1 for pixels smaller than a byte. The output is appended. To
+// filter an image a few rows at a time, the last row of the previous call
+// is given as previous; it is null for the first rows of the image.
+void png_filter(const unsigned char *data,
+                size_t stride,
+                size_t rows,
+                unsigned bytes_per_pixel,
+                std::string &out,
+                const unsigned char *previous = nullptr);
+
+// The /DecodeParms of an image filtered with png_filter(). It is an array
+// with a single dictionary, since the /Filter of images is an array too.
+std::string png_decode_parms(unsigned colors, unsigned bpc, unsigned columns);
+
+} // namespace predictor
+} // namespace paddlefish
+
+#endif // PADDLEFISH_PREDICTOR_H
+
+// vim: ts=2:sw=2:expandtab
@@ -0,0 +1,58 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef PADDLEFISH_RESAMPLE_H
+#define PADDLEFISH_RESAMPLE_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace paddlefish {
+namespace resample {
+
+// The filters used to compute each pixel of a resampled image from the
+// pixels around it. BOX averages the pixels it covers and is the fastest,
+// BILINEAR weights them by distance, and LANCZOS (with three lobes) keeps
+// the most detail.
+enum class Filter:std::uint8_t
+{
+  BOX,
+  BILINEAR,
+  LANCZOS
+};
+
+// Resample an image with 8 bits per component, whose rows have stride
+// bytes, to the given size. The rows of the output have
+// out_width * channels bytes. The image is resampled first horizontally,
+// then vertically, with fixed point weights; the inner loops run over
+// consecutive bytes, so that the compiler vectorizes them.
+void resample(const unsigned char *data,
+              size_t stride,
+              unsigned width,
+              unsigned height,
+              unsigned channels,
+              unsigned char *out,
+              unsigned out_width,
+              unsigned out_height,
+              Filter filter);
+
+} // namespace resample
+} // namespace paddlefish
+
+#endif // PADDLEFISH_RESAMPLE_H
+
+// vim: ts=2:sw=2:expandtab
@@ -0,0 +1,146 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef PADDLEFISH_SINK_H
+#define PADDLEFISH_SINK_H
+
+#include <cstddef>
+#include <ios>
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <vector>
+
+namespace paddlefish {
+
+class Sink;
+
+typedef std::shared_ptr<Sink> SinkPtr;
+
+// A sink is the destination of the bytes of a document. It counts the
+// bytes written to it, so that the offsets of the objects do not depend on
+// the destination being able to tell its position, which pipes and sockets
+// cannot do.
+class Sink
+{
+  public:
+    Sink(): written(0) {}
+    virtual ~Sink() {}
+
+    void write(const char *data, size_t size)
+    {
+      do_write(data, size);
+      written += size;
+      return;
+    }
+
+    // Send the buffered bytes, if any, to the destination.
+    virtual void flush() {}
+
+    // The number of bytes written so far.
+    std::streamoff position() const { return written; }
+
+  protected:
+    virtual void do_write(const char *data, size_t size) = 0;
+
+  private:
+    std::streamoff written;
+};
+
+// A sink that writes to an output stream. This allows writing to streams
+// which do not know their position.
+class OstreamSink: public Sink
+{
+  public:
+    OstreamSink(std::ostream &out_stream): out(out_stream) {}
+    ~OstreamSink() {}
+
+    void flush();
+
+  protected:
+    void do_write(const char *data, size_t size);
+
+  private:
+    std::ostream &out;
+};
+
+// A sink that writes to a file descriptor, which can be a file, a pipe or
+// a socket. Small writes are gathered in a buffer; a big write is sent
+// together with the buffered bytes in a single writev() call, without
+// copying it to the buffer. The file descriptor is not closed by the sink.
+class FdSink: public Sink
+{
+  public:
+    FdSink(int fd, size_t buffer_size = 65536);
+    ~FdSink();
+
+    void flush();
+
+  protected:
+    void do_write(const char *data, size_t size);
+
+  private:
+    // Write the buffered bytes followed by the given ones, which may be
+    // null.
+    void write_out(const char *data, size_t size);
+
+    int fd;
+    std::vector<char> buffer;
+    size_t buffered;
+};
+
+// A stream buffer which sends its contents to a sink. Its position is the
+// position of the sink plus the bytes not yet sent to it, so tellp() on a
+// stream that uses it is always valid and does not flush anything.
+class SinkStreambuf: public std::streambuf
+{
+  public:
+    SinkStreambuf(Sink &out_sink, size_t buffer_size = 4096);
+    ~SinkStreambuf();
+
+  protected:
+    int_type overflow(int_type c);
+    std::streamsize xsputn(const char *s, std::streamsize n);
+    int sync();
+    pos_type seekoff(off_type off,
+                     std::ios_base::seekdir dir,
+                     std::ios_base::openmode which);
+
+  private:
+    void flush_buffer();
+
+    Sink &sink;
+    std::vector<char> buffer;
+};
+
+// An output stream that writes to a sink. Errors of the sink are thrown
+// as exceptions instead of just setting the stream state.
+class SinkStream: public std::ostream
+{
+  public:
+    SinkStream(Sink &out_sink);
+    ~SinkStream() {}
+
+  private:
+    SinkStreambuf buffer;
+};
+
+} // namespace paddlefish
+
+#endif // PADDLEFISH_SINK_H
+
+// vim: ts=2:sw=2:expandtab
@@ -51,9 +51,7 @@ class Text: public PdfObject
 
     Type get_type() const { return Type::TEXT; }
 
-    std::ostream& to_stream(std::ostream &o) const { return o << get_contents(); }
-
-    const std::string get_contents() const;
+    void append_contents(std::string &buffer) const;
 
     // Add a \000 (character 0x00 in octal) before each character in the
     // text. This is needed to use the default CID to GID map we use for
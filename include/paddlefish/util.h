@@ -18,6 +18,8 @@
 #ifndef PADDLEFISH_UTIL_H
 #define PADDLEFISH_UTIL_H
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 
 namespace paddlefish {
@@ -75,6 +77,14 @@ std::string escape_string(const std::string &s);
 // color spaces are not handled separately.
 std::string color_profile_ref(unsigned cs_id);
 
+// Returns the 64-bit FNV-1a hash of the given bytes. It is not a
+// cryptographic hash; equal hashes must be confirmed comparing the bytes.
+std::uint64_t hash_bytes(const void *data, size_t size);
+
+// Returns the SHA-256 digest of the given bytes, as 32 raw bytes. Unlike
+// the hash above, equal digests can be taken for equal contents.
+std::string sha256(const void *data, size_t size);
+
 } // namespace util
 } // namespace paddlefish
 
@@ -0,0 +1,335 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <paddlefish/ccitt.h>
+#include <paddlefish/util.h>
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace paddlefish {
+namespace ccitt {
+
+// A code of the T.4 tables: its length in bits and its value.
+struct Code
+{
+  unsigned length;
+  unsigned value;
+};
+
+// Runs of 0 to 63 white pixels.
+static const Code WHITE_TERMINATING[64] = {
+  {  8, 0x035 }, {  6, 0x007 }, {  4, 0x007 }, {  4, 0x008 },
+  {  4, 0x00b }, {  4, 0x00c }, {  4, 0x00e }, {  4, 0x00f },
+  {  5, 0x013 }, {  5, 0x014 }, {  5, 0x007 }, {  5, 0x008 },
+  {  6, 0x008 }, {  6, 0x003 }, {  6, 0x034 }, {  6, 0x035 },
+  {  6, 0x02a }, {  6, 0x02b }, {  7, 0x027 }, {  7, 0x00c },
+  {  7, 0x008 }, {  7, 0x017 }, {  7, 0x003 }, {  7, 0x004 },
+  {  7, 0x028 }, {  7, 0x02b }, {  7, 0x013 }, {  7, 0x024 },
+  {  7, 0x018 }, {  8, 0x002 }, {  8, 0x003 }, {  8, 0x01a },
+  {  8, 0x01b }, {  8, 0x012 }, {  8, 0x013 }, {  8, 0x014 },
+  {  8, 0x015 }, {  8, 0x016 }, {  8, 0x017 }, {  8, 0x028 },
+  {  8, 0x029 }, {  8, 0x02a }, {  8, 0x02b }, {  8, 0x02c },
+  {  8, 0x02d }, {  8, 0x004 }, {  8, 0x005 }, {  8, 0x00a },
+  {  8, 0x00b }, {  8, 0x052 }, {  8, 0x053 }, {  8, 0x054 },
+  {  8, 0x055 }, {  8, 0x024 }, {  8, 0x025 }, {  8, 0x058 },
+  {  8, 0x059 }, {  8, 0x05a }, {  8, 0x05b }, {  8, 0x04a },
+  {  8, 0x04b }, {  8, 0x032 }, {  8, 0x033 }, {  8, 0x034 }
+};
+
+// Runs of 64 to 1728 white pixels, in steps of 64.
+static const Code WHITE_MAKEUP[27] = {
+  {  5, 0x01b }, {  5, 0x012 }, {  6, 0x017 }, {  7, 0x037 },
+  {  8, 0x036 }, {  8, 0x037 }, {  8, 0x064 }, {  8, 0x065 },
+  {  8, 0x068 }, {  8, 0x067 }, {  9, 0x0cc }, {  9, 0x0cd },
+  {  9, 0x0d2 }, {  9, 0x0d3 }, {  9, 0x0d4 }, {  9, 0x0d5 },
+  {  9, 0x0d6 }, {  9, 0x0d7 }, {  9, 0x0d8 }, {  9, 0x0d9 },
+  {  9, 0x0da }, {  9, 0x0db }, {  9, 0x098 }, {  9, 0x099 },
+  {  9, 0x09a }, {  6, 0x018 }, {  9, 0x09b }
+};
+
+// Runs of 0 to 63 black pixels.
+static const Code BLACK_TERMINATING[64] = {
+  { 10, 0x037 }, {  3, 0x002 }, {  2, 0x003 }, {  2, 0x002 },
+  {  3, 0x003 }, {  4, 0x003 }, {  4, 0x002 }, {  5, 0x003 },
+  {  6, 0x005 }, {  6, 0x004 }, {  7, 0x004 }, {  7, 0x005 },
+  {  7, 0x007 }, {  8, 0x004 }, {  8, 0x007 }, {  9, 0x018 },
+  { 10, 0x017 }, { 10, 0x018 }, { 10, 0x008 }, { 11, 0x067 },
+  { 11, 0x068 }, { 11, 0x06c }, { 11, 0x037 }, { 11, 0x028 },
+  { 11, 0x017 }, { 11, 0x018 }, { 12, 0x0ca }, { 12, 0x0cb },
+  { 12, 0x0cc }, { 12, 0x0cd }, { 12, 0x068 }, { 12, 0x069 },
+  { 12, 0x06a }, { 12, 0x06b }, { 12, 0x0d2 }, { 12, 0x0d3 },
+  { 12, 0x0d4 }, { 12, 0x0d5 }, { 12, 0x0d6 }, { 12, 0x0d7 },
+  { 12, 0x06c }, { 12, 0x06d }, { 12, 0x0da }, { 12, 0x0db },
+  { 12, 0x054 }, { 12, 0x055 }, { 12, 0x056 }, { 12, 0x057 },
+  { 12, 0x064 }, { 12, 0x065 }, { 12, 0x052 }, { 12, 0x053 },
+  { 12, 0x024 }, { 12, 0x037 }, { 12, 0x038 }, { 12, 0x027 },
+  { 12, 0x028 }, { 12, 0x058 }, { 12, 0x059 }, { 12, 0x02b },
+  { 12, 0x02c }, { 12, 0x05a }, { 12, 0x066 }, { 12, 0x067 }
+};
+
+// Runs of 64 to 1728 black pixels, in steps of 64.
+static const Code BLACK_MAKEUP[27] = {
+  { 10, 0x00f }, { 12, 0x0c8 }, { 12, 0x0c9 }, { 12, 0x05b },
+  { 12, 0x033 }, { 12, 0x034 }, { 12, 0x035 }, { 13, 0x06c },
+  { 13, 0x06d }, { 13, 0x04a }, { 13, 0x04b }, { 13, 0x04c },
+  { 13, 0x04d }, { 13, 0x072 }, { 13, 0x073 }, { 13, 0x074 },
+  { 13, 0x075 }, { 13, 0x076 }, { 13, 0x077 }, { 13, 0x052 },
+  { 13, 0x053 }, { 13, 0x054 }, { 13, 0x055 }, { 13, 0x05a },
+  { 13, 0x05b }, { 13, 0x064 }, { 13, 0x065 }
+};
+
+// Runs of 1792 to 2560 pixels of either color, in steps of 64.
+static const Code EXTENDED_MAKEUP[13] = {
+  { 11, 0x008 }, { 11, 0x00c }, { 11, 0x00d }, { 12, 0x012 },
+  { 12, 0x013 }, { 12, 0x014 }, { 12, 0x015 }, { 12, 0x016 },
+  { 12, 0x017 }, { 12, 0x01c }, { 12, 0x01d }, { 12, 0x01e },
+  { 12, 0x01f }
+};
+
+static const Code PASS = { 4, 0x1 };
+static const Code HORIZONTAL = { 3, 0x1 };
+// Vertical modes, indexed by b1 - a1 + 3: from VR3 to VL3.
+static const Code VERTICAL[7] = {
+  { 7, 0x03 }, { 6, 0x03 }, { 3, 0x3 }, { 1, 0x1 }, { 3, 0x2 }, { 6, 0x02 },
+  { 7, 0x02 }
+};
+static const Code END_OF_LINE = { 12, 0x001 };
+
+// Appends codes to a string, most significant bit first.
+class BitWriter
+{
+  public:
+    BitWriter(std::string &out_string): out(out_string), bits(0), count(0) {}
+
+    void put(const Code &code)
+    {
+      bits = (bits << code.length) | code.value;
+      count += code.length;
+      while (count >= 8)
+      {
+        count -= 8;
+        out += (char)(bits >> count);
+      }
+      bits &= (1u << count) - 1;
+      return;
+    }
+
+    // Write the pending bits, padded with zeros to a whole byte.
+    void flush()
+    {
+      if (count > 0)
+      {
+        out += (char)(bits << (8 - count));
+        bits = 0;
+        count = 0;
+      }
+      return;
+    }
+
+  private:
+    std::string &out;
+    std::uint32_t bits;
+    unsigned count;
+};
+
+static unsigned leading_zeros(unsigned char b)
+{
+#ifdef __GNUC__
+  return (unsigned)__builtin_clz(b) - 24;
+#else
+  unsigned n = 0;
+  while (!(b & 0x80))
+  {
+    b <<= 1;
+    ++n;
+  }
+  return n;
+#endif
+}
+
+static int pixel(const unsigned char *line, unsigned pos)
+{
+  return (line[pos >> 3] >> (7 - (pos & 7))) & 1;
+}
+
+// Returns the position of the first pixel from pos on whose color is not
+// the given one, or end if there is none. Runs of the color are skipped a
+// word at a time, so long runs in scanned pages cost little.
+static unsigned find_diff(const unsigned char *line,
+                          unsigned pos,
+                          unsigned end,
+                          int color)
+{
+  const unsigned char skip = color ? 0xff : 0x00;
+  if (pos >= end)
+  {
+    return end;
+  }
+
+  // The rest of a partial byte.
+  if (pos & 7)
+  {
+    unsigned char b = (unsigned char)((line[pos >> 3] ^ skip) << (pos & 7));
+    if (b)
+    {
+      pos += leading_zeros(b);
+      return pos < end ? pos : end;
+    }
+    pos = (pos | 7) + 1;
+  }
+
+  const std::uint64_t skip_word = color ? ~(std::uint64_t)0 : 0;
+  while (pos + 64 <= end)
+  {
+    std::uint64_t word;
+    memcpy(&word, line + (pos >> 3), sizeof(word));
+    if (word != skip_word)
+    {
+      break;
+    }
+    pos += 64;
+  }
+
+  while (pos < end)
+  {
+    unsigned char b = line[pos >> 3] ^ skip;
+    if (b)
+    {
+      pos += leading_zeros(b);
+      return pos < end ? pos : end;
+    }
+    pos += 8;
+  }
+
+  return end;
+}
+
+// Write a run of pixels of a color in horizontal mode.
+static void put_run(BitWriter &bits, unsigned run, int color)
+{
+  const Code *terminating = color ? BLACK_TERMINATING : WHITE_TERMINATING;
+  const Code *makeup = color ? BLACK_MAKEUP : WHITE_MAKEUP;
+
+  while (run >= 2624)
+  {
+    bits.put(EXTENDED_MAKEUP[12]);
+    run -= 2560;
+  }
+  if (run >= 64)
+  {
+    unsigned m = run / 64;
+    bits.put(m <= 27 ? makeup[m - 1] : EXTENDED_MAKEUP[m - 28]);
+    run -= m * 64;
+  }
+  bits.put(terminating[run]);
+
+  return;
+}
+
+// Encode a row given the one above it, with the two-dimensional coding of
+// T.6: a0 is the last coded position, a1 and a2 the next changes of color
+// in the row, and b1 and b2 the changes in the reference row after a0.
+static void encode_row(const unsigned char *line,
+                       const unsigned char *reference,
+                       unsigned width,
+                       BitWriter &bits)
+{
+  unsigned a0 = 0;
+  unsigned a1 = pixel(line, 0) ? 0 : find_diff(line, 0, width, 0);
+  unsigned b1 = pixel(reference, 0) ? 0 : find_diff(reference, 0, width, 0);
+
+  for (;;)
+  {
+    unsigned b2 = b1 < width ?
+      find_diff(reference, b1, width, pixel(reference, b1)) : width;
+    if (b2 < a1)
+    {
+      bits.put(PASS);
+      a0 = b2;
+    }
+    else
+    {
+      int d = (int)b1 - (int)a1;
+      if (d >= -3 && d <= 3)
+      {
+        bits.put(VERTICAL[d + 3]);
+        a0 = a1;
+      }
+      else
+      {
+        unsigned a2 = a1 < width ?
+          find_diff(line, a1, width, pixel(line, a1)) : width;
+        // At the start of the row, a0 is before the first pixel, white.
+        int color = (a0 + a1 == 0 || !pixel(line, a0)) ? 0 : 1;
+        bits.put(HORIZONTAL);
+        put_run(bits, a1 - a0, color);
+        put_run(bits, a2 - a1, !color);
+        a0 = a2;
+      }
+    }
+
+    if (a0 >= width)
+    {
+      break;
+    }
+    int color = pixel(line, a0);
+    a1 = find_diff(line, a0, width, color);
+    b1 = find_diff(reference, a0, width, !color);
+    b1 = find_diff(reference, b1, width, color);
+  }
+
+  return;
+}
+
+void g4_encode(const unsigned char *data,
+               size_t stride,
+               unsigned width,
+               unsigned height,
+               std::string &out)
+{
+  BitWriter bits(out);
+
+  // The row above the first one is white.
+  std::vector<unsigned char> white(stride + 8, 0);
+  const unsigned char *reference = white.data();
+  for (unsigned r = 0; r < height && width > 0; ++r)
+  {
+    const unsigned char *line = data + r * stride;
+    encode_row(line, reference, width, bits);
+    reference = line;
+  }
+
+  // The end-of-block code is two end-of-line codes.
+  bits.put(END_OF_LINE);
+  bits.put(END_OF_LINE);
+  bits.flush();
+
+  return;
+}
+
+std::string g4_decode_parms(unsigned columns, unsigned rows)
+{
+  return "<< /K -1 /Columns " + util::to_str(columns) +
+    " /Rows " + util::to_str(rows) + " /BlackIs1 true >>";
+}
+
+} // namespace ccitt
+} // namespace paddlefish
+
+// vim: ts=2:sw=2:expandtab
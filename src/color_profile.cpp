@@ -19,7 +19,7 @@
 #include <paddlefish/colorspace_properties.h>
 #include <paddlefish/util.h>
 
-#include <sstream>
+#include <string>
 
 namespace paddlefish {
 
@@ -82,34 +82,57 @@ ColorProfile::ColorProfile(ColorProfile::Type t,
     throw std::runtime_error("color profile must be INDEXED");
   }
 
-  contents = "[ /Indexed\n  ";
+  std::string base_string;
   switch (base)
   {
   case COLORSPACE_DEVICERGB:
-    contents += "/DeviceRGB";
+    base_string = "/DeviceRGB";
     break;
   case COLORSPACE_DEVICEGRAY:
-    contents += "/DeviceGray";
+    base_string = "/DeviceGray";
     break;
   case COLORSPACE_DEVICECMYK:
-    contents += "/DeviceCMYK";
+    base_string = "/DeviceCMYK";
     break;
   default:
-    contents += util::to_str(base) + " 0 R";
+    base_string = util::to_str(base) + " 0 R";
     break;
   }
-  contents += "\n  " + util::to_str(num_colors - 1) + "\n  (";
-  std::string colors_string;
-  std::stringstream colors_stream(colors_string);
+  std::string lookup;
   for (unsigned color = 0; color < num_colors; ++color)
   {
-    for (unsigned component = 0; component < base_components; ++component)
+    lookup.append(reinterpret_cast<const char*>(colors[color]),
+                  base_components);
+  }
+  contents = indexed_array(base_string, lookup, num_colors);
+}
+
+std::string ColorProfile::indexed_array(const std::string &base,
+                                        const std::string &lookup,
+                                        unsigned num_colors)
+{
+  // The lookup table is a literal string. Parentheses and backslashes are
+  // escaped, and so are carriage returns, which readers would take as line
+  // ends.
+  std::string array = "[ /Indexed\n  " + base + "\n  " +
+    util::to_str(num_colors - 1) + "\n  (";
+  for (size_t i = 0; i < lookup.size(); ++i)
+  {
+    char c = lookup[i];
+    if (c == '(' || c == ')' || c == '\\')
+    {
+      array += '\\';
+    }
+    else if (c == '\r')
     {
-      unsigned char c = colors[color][component];
-      colors_stream << c;
+      array += "\\r";
+      continue;
     }
+    array += c;
   }
-  contents += colors_stream.str() + ")\n]";
+  array += ")\n]";
+
+  return array;
 }
 
 ColorProfile::ColorProfile(Type t, unsigned stream_id)
@@ -0,0 +1,225 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <paddlefish/compression_cache.h>
+#include <paddlefish/util.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <thread>
+
+#ifdef PADDLEFISH_WINDOWS
+#include <direct.h>
+#include <process.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace paddlefish {
+namespace flate {
+
+#ifdef PADDLEFISH_USE_ZLIB
+
+// Gives each file written by this process a different temporary name.
+static std::atomic<unsigned long> temporary_count(0);
+
+static std::string to_hex(std::uint64_t value)
+{
+  static const char digits[] = "0123456789abcdef";
+  std::string hex(16, '0');
+  for (int i = 15; i >= 0; --i, value >>= 4)
+  {
+    hex[i] = digits[value & 0xf];
+  }
+  return hex;
+}
+
+static bool read_file(const std::string &path, std::string &contents)
+{
+  std::ifstream f(path, std::ios_base::in | std::ios_base::binary);
+  if (!f.good())
+  {
+    return false;
+  }
+  contents.assign(std::istreambuf_iterator<char>(f),
+                  std::istreambuf_iterator<char>());
+  return !f.bad();
+}
+
+CompressionCache::CompressionCache(const std::string &directory):
+  directory(directory),
+  hits(0),
+  misses(0)
+{
+#ifdef PADDLEFISH_WINDOWS
+  int ret = _mkdir(directory.c_str());
+#else
+  int ret = mkdir(directory.c_str(), 0777);
+#endif
+  if (ret != 0 && errno != EEXIST)
+  {
+    throw std::runtime_error("error creating cache directory \"" +
+                             directory + "\": " + std::strerror(errno));
+  }
+}
+
+bool CompressionCache::deflate(const char *data,
+                               size_t size,
+                               const CompressionPolicy &policy,
+                               std::string &out)
+{
+  std::string path = get_path(data, size, policy);
+  std::string deflated;
+  if (load(path, data, size, deflated))
+  {
+    ++hits;
+  }
+  else
+  {
+    ++misses;
+    deflated.clear();
+    PooledDeflater deflater(policy);
+    deflater->compress(data, size, deflated);
+    store(path, deflated);
+  }
+
+  if (policy.store_incompressible &&
+      deflated.size() >= policy.store_ratio * size)
+  {
+    return false;
+  }
+  out += deflated;
+
+  return true;
+}
+
+bool CompressionCache::deflate_file(const std::string &filename,
+                                    const CompressionPolicy &policy,
+                                    std::string &out)
+{
+  std::string contents;
+  if (!read_file(filename, contents))
+  {
+    throw std::runtime_error("error opening file \"" + filename + "\"");
+  }
+
+  return deflate(contents.data(), contents.size(), policy, out);
+}
+
+CacheStats CompressionCache::get_stats() const
+{
+  CacheStats stats;
+  stats.hits = hits;
+  stats.misses = misses;
+
+  return stats;
+}
+
+// The threads of the policy are left out: blocks deflated in parallel
+// are a different stream, but the same data for the reader.
+std::string CompressionCache::get_path(const char *data,
+                                       size_t size,
+                                       const CompressionPolicy &policy) const
+{
+  return directory + "/" + to_hex(util::hash_bytes(data, size)) + '-' +
+    util::to_str(size) + '-' + util::to_str(policy.level) + '-' +
+    util::to_str((unsigned)policy.strategy) + '-' +
+    util::to_str(policy.mem_level) + '-' + util::to_str(policy.window_bits) +
+    '-' + util::to_str((unsigned)policy.backend) + ".z";
+}
+
+bool CompressionCache::load(const std::string &path,
+                            const char *data,
+                            size_t size,
+                            std::string &deflated) const
+{
+  if (!read_file(path, deflated))
+  {
+    return false;
+  }
+
+  std::string inflated;
+  try
+  {
+    Inflater inflater;
+    inflater.decompress(deflated.data(), deflated.size(), inflated, size);
+  }
+  catch (const std::runtime_error&)
+  {
+    return false;
+  }
+
+  return inflated.size() == size &&
+    memcmp(inflated.data(), data, size) == 0;
+}
+
+void CompressionCache::store(const std::string &path,
+                             const std::string &deflated) const
+{
+#ifdef PADDLEFISH_WINDOWS
+  int pid = _getpid();
+#else
+  int pid = (int)getpid();
+#endif
+  std::string temporary = path + '.' + util::to_str(pid) + '.' +
+    util::to_str(std::hash<std::thread::id>()(std::this_thread::get_id())) +
+    '.' + util::to_str(++temporary_count);
+
+  std::ofstream f(temporary, std::ios_base::out | std::ios_base::binary);
+  f.write(deflated.data(), deflated.size());
+  f.close();
+  // Another process may have stored the same data meanwhile.
+  if (f.fail() || std::rename(temporary.c_str(), path.c_str()) != 0)
+  {
+    std::remove(temporary.c_str());
+  }
+
+  return;
+}
+
+size_t deflate_cached(const char *data,
+                      size_t size,
+                      const CompressionPolicy &policy,
+                      std::string &out)
+{
+  size_t start = out.size();
+  if (policy.cache)
+  {
+    CompressionPolicy always(policy);
+    always.store_incompressible = false;
+    policy.cache->deflate(data, size, always, out);
+  }
+  else
+  {
+    PooledDeflater(policy)->compress(data, size, out);
+  }
+
+  return out.size() - start;
+}
+
+#endif // PADDLEFISH_USE_ZLIB
+
+} // namespace flate
+} // namespace paddlefish
+
+// vim: ts=2:sw=2:expandtab
@@ -17,12 +17,23 @@
 
 #include <paddlefish/custom_object.h>
 
+#include <utility>
+
 namespace paddlefish {
 
-CustomObject::CustomObject(): contents(), use_flate(false) {}
+CustomObject::CustomObject():
+  contents(),
+  use_flate(false),
+  stream_object(false),
+  has_stream_data(false),
+  external_size(0)
+{}
 
-CustomObject::CustomObject(const std::string& text, bool flate):
-  contents(text)
+CustomObject::CustomObject(const std::string& text, bool flate, bool stream):
+  contents(text),
+  stream_object(stream),
+  has_stream_data(false),
+  external_size(0)
 {
 #ifdef PADDLEFISH_USE_ZLIB
   use_flate = flate;
@@ -31,6 +42,94 @@ CustomObject::CustomObject(const std::string& text, bool flate):
 #endif
 }
 
+CustomObject::CustomObject(const std::string& dictionary, std::string&& data):
+  contents(dictionary),
+  use_flate(false),
+  stream_object(true),
+  stream_data(std::move(data)),
+  has_stream_data(true),
+  external_size(0)
+{}
+
+CustomObject::CustomObject(const std::string& dictionary,
+                           const std::shared_ptr<const void> &data,
+                           size_t data_size):
+  contents(dictionary),
+  use_flate(false),
+  stream_object(true),
+  has_stream_data(true),
+  external_data(data),
+  external_size(data_size)
+{}
+
+void CustomObject::set_stream(const std::string& dictionary,
+                              std::string&& data)
+{
+  contents = dictionary;
+  stream_object = true;
+  stream_data = std::move(data);
+  has_stream_data = true;
+  external_data.reset();
+  external_size = 0;
+
+  return;
+}
+
+void CustomObject::set_stream(const std::string& dictionary,
+                              const std::shared_ptr<const void> &data,
+                              size_t data_size)
+{
+  contents = dictionary;
+  stream_object = true;
+  stream_data.clear();
+  has_stream_data = true;
+  external_data = data;
+  external_size = data_size;
+
+  return;
+}
+
+std::ostream& CustomObject::to_stream(std::ostream &os) const
+{
+  os << contents;
+  if (has_stream_data)
+  {
+    os << "\nstream\n";
+    if (external_data)
+    {
+      os.write(static_cast<const char*>(external_data.get()), external_size);
+    }
+    else
+    {
+      os.write(stream_data.data(), stream_data.size());
+    }
+    os << "\nendstream";
+  }
+
+  return os;
+}
+
+void CustomObject::append_contents(std::string &buffer) const
+{
+  buffer += contents;
+  if (has_stream_data)
+  {
+    buffer += "\nstream\n";
+    if (external_data)
+    {
+      buffer.append(static_cast<const char*>(external_data.get()),
+                    external_size);
+    }
+    else
+    {
+      buffer += stream_data;
+    }
+    buffer += "\nendstream";
+  }
+
+  return;
+}
+
 } // namespace paddlefish
 
 // vim: ts=2:sw=2:expandtab
@@ -16,23 +16,46 @@
 // along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <paddlefish/document.h>
+#include <paddlefish/compression_cache.h>
 #include <paddlefish/flate.h>
 #include <paddlefish/custom_object.h>
+#include <paddlefish/executor.h>
 #include <paddlefish/file_stream.h>
 #include <paddlefish/font.h>
 #include <paddlefish/color_profile.h>
 #include <paddlefish/cid_to_gid.h>
+#include <paddlefish/predictor.h>
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <condition_variable>
+#include <exception>
 #include <fstream>
 #include <iomanip>
+#include <mutex>
 #include <sstream>
+#include <stdexcept>
+#include <thread>
 
 namespace paddlefish {
 
 Document::Document():
   next_object_number(1),
   first_body_object_number(6),
-  total_body_objects(0)
+  total_body_objects(0),
+  page_count(0),
+  bound_stream(nullptr),
+  streamed_body_objects(0),
+  output_profile(OutputProfile::PDF_1_4),
+  serialization_threads(1),
+  content_flate(false),
+  image_deduplication(true),
+  max_image_resolution(0.),
+  image_resampling_filter(resample::Filter::LANCZOS),
+  sampled_payloads(0),
+  stored_payloads(0),
+  stored_payload_bytes(0)
 {
   colorspace_properties.emplace(
     COLORSPACE_DEVICERGB,
@@ -58,19 +81,53 @@ Document::Document():
   ocgs = std::vector<OcgPtr>();
 }
 
+Document::Document(const PreamblePtr &preamble_ptr):
+  Document()
+{
+  preamble = preamble_ptr;
+  output_profile = (preamble->uses_object_streams() ?
+                    OutputProfile::PDF_1_5 :
+                    OutputProfile::PDF_1_4);
+
+  // The objects of the preamble keep their numbers, and the objects added
+  // to this document are numbered after them.
+  total_body_objects = preamble->get_object_count();
+
+  colorspace_properties = preamble->colorspace_properties;
+  image_colorspaces = preamble->image_colorspaces;
+  custom_object_page_numbers = preamble->custom_object_page_numbers;
+}
+
 void Document::push_back_page(const PagePtr& page_ptr)
 {
   page_ptr->set_document(this);
 
-  pages.push_back(page_ptr);
+  page_ptr->set_number(++page_count);
 
-  page_ptr->set_number((unsigned int)pages.size());
+  if (is_streaming())
+  {
+    stream_page(*bound_stream, page_ptr);
+  }
+  else
+  {
+    pages.push_back(page_ptr);
+  }
 
   return;
 }
 
 unsigned Document::add_standard_type1_font(const std::string& font_name)
 {
+  // The fonts of the preamble are already written.
+  if (preamble)
+  {
+    auto font = preamble->standard_fonts.find(font_name);
+    if (font != preamble->standard_fonts.end())
+    {
+      return font->second;
+    }
+  }
+
   // Search in the standard font list if this font was already added.
   // If yes, return its identifier.
   for (unsigned i = 0; i < (unsigned)body_objects.size(); ++i)
@@ -251,6 +308,32 @@ unsigned Document::add_separation_color_space(std::string name,
 
 std::ostream& Document::to_stream(std::ostream &out_stream)
 {
+  if (is_streaming())
+  {
+    throw std::runtime_error("the document is already bound to a stream");
+  }
+
+  if (preamble && preamble->uses_object_streams() != use_object_streams())
+  {
+    throw std::runtime_error("the output profile differs from the one of "
+                             "the preamble");
+  }
+
+  // The offsets of the objects are computed with tellp(), which fails on
+  // pipes and sockets. We write to those through a sink, that counts the
+  // bytes written.
+  if (out_stream && out_stream.tellp() == std::streampos(-1))
+  {
+    OstreamSink out_sink(out_stream);
+    to_sink(out_sink);
+    return out_stream;
+  }
+
+  writer = ObjectWriterPtr(new ObjectWriter(out_stream, use_object_streams()));
+  page_object_numbers.clear();
+  page_labels.clear();
+  shared_images.clear();
+
   // We start the objects at number 6.
   next_object_number = 6;
 
@@ -265,25 +348,235 @@ std::ostream& Document::to_stream(std::ostream &out_stream)
   // Assign numbers to the objects in the pages of the document.
   for (auto const &p: pages)
   {
+    page_object_numbers.push_back(next_object_number);
+    page_labels.push_back(p->get_label());
     next_object_number = p->set_object_number(next_object_number);
     add_ocg_list(p->get_ocgs());
   }
 
   // Write to the stream the four components of the document.
   write_header(out_stream);
+  write_structure(out_stream);
   write_objects(out_stream);
+  write_object_stream();
+  write_xref(out_stream);
+  write_trailer(out_stream);
+
+  writer.reset();
+  shared_images.clear();
+
+  return out_stream;
+}
+
+void Document::to_sink(Sink &out_sink)
+{
+  SinkStream out_stream(out_sink);
+  to_stream(out_stream);
+
+  return;
+}
+
+PreamblePtr Document::freeze_preamble()
+{
+  if (is_streaming())
+  {
+    throw std::runtime_error("the document is bound to a stream");
+  }
+
+  std::shared_ptr<Preamble> frozen(new Preamble());
+  std::ostringstream contents;
+
+  // The objects are written as they would be in to_stream(), to a buffer
+  // whose offsets are relocated when it is copied to an output. Pending
+  // objects are packed in an object stream of the preamble, so that
+  // nothing is left to write.
+  writer = ObjectWriterPtr(new ObjectWriter(contents, use_object_streams()));
+  write_preamble(contents);
+  next_object_number = write_body_objects(contents, 0, 6 + preamble_objects());
+  write_object_stream();
+
+  frozen->bytes = contents.str();
+  frozen->entries = writer->get_entries();
+  frozen->object_count = next_object_number - 6;
+  frozen->object_streams = use_object_streams();
+  writer.reset();
+
+  frozen->colorspace_properties = colorspace_properties;
+  frozen->image_colorspaces = image_colorspaces;
+  frozen->custom_object_page_numbers = custom_object_page_numbers;
+
+  // Standard fonts are looked up by name. Their numbers are the ones
+  // write_body_objects() gave them.
+  if (preamble)
+  {
+    frozen->standard_fonts = preamble->standard_fonts;
+  }
+  unsigned object_number = 6 + preamble_objects();
+  for (auto const &o: body_objects)
+  {
+    if (o->get_type() == PdfObject::Type::FONT &&
+        std::dynamic_pointer_cast<Font>(o)->get_font_type() ==
+        Font::Type::STANDARD_TYPE_1)
+    {
+      frozen->standard_fonts.emplace(
+        std::dynamic_pointer_cast<Font>(o)->get_name(), object_number);
+    }
+    object_number +=
+      (o->get_type() == PdfObject::Type::FILE_STREAM ? 2 : 1);
+  }
+
+  return frozen;
+}
+
+void Document::start_stream(std::ostream &out_stream)
+{
+  if (is_streaming())
+  {
+    throw std::runtime_error("the document is already bound to a stream");
+  }
+
+  // As in to_stream(), streams that cannot tell their position are
+  // written through a sink.
+  if (out_stream && out_stream.tellp() == std::streampos(-1))
+  {
+    SinkPtr out_sink(new OstreamSink(out_stream));
+    start_stream(*out_sink);
+    adapter_sink = out_sink;
+    return;
+  }
+
+  adapter_stream.reset();
+  adapter_sink.reset();
+  bind_stream(out_stream);
+
+  return;
+}
+
+void Document::start_stream(Sink &out_sink)
+{
+  if (is_streaming())
+  {
+    throw std::runtime_error("the document is already bound to a stream");
+  }
+
+  adapter_stream.reset();
+  adapter_sink.reset();
+  adapter_stream = std::make_shared<SinkStream>(out_sink);
+  bind_stream(*adapter_stream);
+
+  return;
+}
+
+void Document::bind_stream(std::ostream &out_stream)
+{
+  if (preamble && preamble->uses_object_streams() != use_object_streams())
+  {
+    throw std::runtime_error("the output profile differs from the one of "
+                             "the preamble");
+  }
+
+  bound_stream = &out_stream;
+
+  writer = ObjectWriterPtr(new ObjectWriter(out_stream, use_object_streams()));
+  page_object_numbers.clear();
+  page_labels.clear();
+  shared_images.clear();
+
+  start_stream_position = out_stream.tellp();
+
+  // Body objects and pages share the numbers from 6 on, in the order they
+  // are written. The first five objects are written by finish_stream().
+  first_body_object_number = next_object_number = 6;
+  streamed_body_objects = 0;
+
+  write_header(out_stream);
+
+  // The preamble comes right after the header, with the first numbers.
+  write_preamble(out_stream);
+  next_object_number += preamble_objects();
+
+  // Pages pushed back before binding the stream are written right now.
+  for (auto const &p: pages)
+  {
+    stream_page(out_stream, p);
+  }
+  pages.clear();
+
+  return;
+}
+
+std::ostream& Document::finish_stream()
+{
+  if (!is_streaming())
+  {
+    throw std::runtime_error("the document is not bound to a stream");
+  }
+
+  std::ostream &out_stream = *bound_stream;
+
+  // Write the body objects added after the last page.
+  next_object_number = write_body_objects(out_stream,
+                                          streamed_body_objects,
+                                          next_object_number);
+  streamed_body_objects = body_objects.size();
+
+  write_structure(out_stream);
+  write_object_stream();
   write_xref(out_stream);
   write_trailer(out_stream);
 
+  writer.reset();
+  bound_stream = nullptr;
+  shared_images.clear();
+
   return out_stream;
 }
 
+void Document::stream_page(std::ostream &out_stream, const PagePtr &page_ptr)
+{
+  // The body objects added since the last written page got the numbers
+  // right before the ones of this page, so they are written first.
+  next_object_number = write_body_objects(out_stream,
+                                          streamed_body_objects,
+                                          next_object_number);
+  streamed_body_objects = body_objects.size();
+
+  page_object_numbers.push_back(next_object_number);
+  page_labels.push_back(page_ptr->get_label());
+  next_object_number = page_ptr->set_object_number(next_object_number);
+  add_ocg_list(page_ptr->get_ocgs());
+
+  page_ptr->to_stream(*writer);
+
+  if (writer->object_stream_full())
+  {
+    write_object_stream();
+  }
+
+  // Body objects added from now on are numbered after this page.
+  total_body_objects = next_object_number - first_body_object_number;
+
+  return;
+}
+
+void Document::write_object_stream()
+{
+  if (writer->pending_objects() > 0)
+  {
+    writer->write_object_stream(next_object_number++, compression_policy);
+  }
+
+  return;
+}
+
 std::ostream& Document::write_header(std::ostream &out_stream)
 {
   // Header. The second line is a comment containing four characters with
   // code greater than 127, for the eventual reader to realize that the file
   // is not text.
-  out_stream << "%PDF-1.4\n%" << 
+  out_stream << (output_profile == OutputProfile::PDF_1_5 ?
+                 "%PDF-1.5\n%" :
+                 "%PDF-1.4\n%") <<
     (char)128 << (char)128 << (char)128 << (char)128 << '\n';
 
   // Comments.
@@ -292,22 +585,28 @@ std::ostream& Document::write_header(std::ostream &out_stream)
     out_stream << "% " << c << '\n';
   }
 
-  // Object 1 is the document catalog. Before writing the bytes
-  // corresponding to the object 1, we compute its offset to the
-  // beginning of the file. We compute offsets for each output object.
-  object_offsets.push_back(out_stream.tellp());
-  out_stream << "1 0 obj\n<< /Type /Catalog\n   /Outlines 2 0 R\n";
-  out_stream << "   /Pages 3 0 R\n   /PageLabels 4 0 R\n";
+  return out_stream;
+}
+
+std::ostream& Document::write_structure(std::ostream &out_stream)
+{
+  // These objects are not streams, so we build each of them apart and
+  // give it to the writer.
+  std::ostringstream object;
+
+  // Object 1 is the document catalog.
+  object << "<< /Type /Catalog\n   /Outlines 2 0 R\n";
+  object << "   /Pages 3 0 R\n   /PageLabels 4 0 R\n";
 
   // Print OCG information on the catalog if needed.
   if (0 < ocgs.size())
   {
-    out_stream << "   /OCProperties << /OCGs [ ";
+    object << "   /OCProperties << /OCGs [ ";
     for (size_t iocg = 0; iocg < ocgs.size(); ++iocg)
     {
-      out_stream << ocgs[iocg]->object_number << " 0 R ";
+      object << ocgs[iocg]->object_number << " 0 R ";
     }
-    out_stream << "]\n                    /D << /Name (Default)\n" <<
+    object << "]\n                    /D << /Name (Default)\n" <<
       "                          /Order";
     unsigned nesting_level, last_nesting_level = 0;
     for (size_t iocg = 0; iocg < ocgs.size(); ++iocg)
@@ -322,7 +621,7 @@ std::ostream& Document::write_header(std::ostream &out_stream)
         // If the nesting level is bigger than the last used level, then
         // it is strictly one higher. Append an array containing the new
         // group to the end of the proper array.
-        out_stream << " [" ;
+        object << " [" ;
       }
       else
       {
@@ -332,139 +631,344 @@ std::ostream& Document::write_header(std::ostream &out_stream)
           // amount of brackets.
           for (; nesting_level < last_nesting_level; --last_nesting_level)
           {
-            out_stream << " ]";
+            object << " ]";
           }
         }
       }
       last_nesting_level = nesting_level;
-      out_stream << ' ' << std::to_string(ocgs[iocg]->object_number) << " 0 R";
+      object << ' ' << std::to_string(ocgs[iocg]->object_number) << " 0 R";
     }
     for (; last_nesting_level > 0; --last_nesting_level)
-      out_stream << " ]";
-    out_stream << "\n                          /BaseState /ON\n" <<
+      object << " ]";
+    object << "\n                          /BaseState /ON\n" <<
       "                       >>\n                 >>\n";
   }
 
-  out_stream << ">>\nendobj\n";
+  object << ">>";
+  writer->write_object(1, object.str());
 
   // Object 2 is the document outline.
-  object_offsets.push_back(out_stream.tellp());
-  out_stream << "2 0 obj\n<< /Type /Outlines\n   /Count 0\n>>\nendobj\n";
+  writer->write_object(2, "<< /Type /Outlines\n   /Count 0\n>>");
 
   // Object 3 is the page dictionary.
-  object_offsets.push_back(out_stream.tellp());
-  out_stream << "3 0 obj\n<< /Type /Pages\n   /Kids [\n";
+  object.str("");
+  object << "<< /Type /Pages\n   /Kids [\n";
 
-  for (auto const &p: pages)
+  for (auto const &n: page_object_numbers)
   {
-    out_stream << "           " << p->get_object_number() << " 0 R\n";
+    object << "           " << n << " 0 R\n";
   }
 
   // Add custom references.
   for (size_t i = 0; i < custom_object_page_numbers.size(); ++i)
   {
-    out_stream << "           " << custom_object_page_numbers[i] << " 0 R\n";
+    object << "           " << custom_object_page_numbers[i] << " 0 R\n";
   }
-  out_stream << "         ]\n   /Count " <<
-    pages.size() + custom_object_page_numbers.size() << "\n>>\nendobj\n";
+  object << "         ]\n   /Count " <<
+    page_object_numbers.size() + custom_object_page_numbers.size() << "\n>>";
+  writer->write_object(3, object.str());
 
   // Write page labels in object number 4.
   // TODO: avoid writing all of them, in order to save space.
-  object_offsets.push_back(out_stream.tellp());
-  out_stream << "4 0 obj\n<< /Nums [\n";
-  for (size_t i = 0; i < pages.size(); ++i)
+  object.str("");
+  object << "<< /Nums [\n";
+  for (size_t i = 0; i < page_labels.size(); ++i)
   {
-    out_stream << "           " << i << " << ";
-    if ("" == pages[i]->get_label())
+    object << "           " << i << " << ";
+    if ("" == page_labels[i])
     {
-      out_stream << "/S /D";
+      object << "/S /D";
     }
     else
     {
-      out_stream << "/P (" << pages[i]->get_label() << ")";
+      object << "/P (" << page_labels[i] << ")";
     }
-    out_stream << " >>\n";
+    object << " >>\n";
   }
-  out_stream << "         ]\n>>\nendobj\n";
+  object << "         ]\n>>";
+  writer->write_object(4, object.str());
 
   // Write document info in object number 5.
-  object_offsets.push_back(out_stream.tellp());
-  out_stream << "5 0 obj\n<<\n";
+  object.str("");
+  object << "<<\n";
   if (!document_information.title.empty())
-    out_stream << "   /Title (" << document_information.title << ")\n";
+    object << "   /Title (" << document_information.title << ")\n";
   if (!document_information.author.empty())
-    out_stream << "   /Author ("<< document_information.author << ")\n";
+    object << "   /Author ("<< document_information.author << ")\n";
   if (!document_information.subject.empty())
-    out_stream << "   /Subject (" << document_information.subject << ")\n";
+    object << "   /Subject (" << document_information.subject << ")\n";
   if (!document_information.keywords.empty())
-    out_stream << "   /Keywords (" << document_information.keywords << ")\n";
+    object << "   /Keywords (" << document_information.keywords << ")\n";
   if (!document_information.creator.empty())
-    out_stream << "   /Creator (" << document_information.creator << ")\n";
+    object << "   /Creator (" << document_information.creator << ")\n";
   if (!document_information.producer.empty())
-    out_stream << "   /Producer (" << document_information.producer << ")\n";
+    object << "   /Producer (" << document_information.producer << ")\n";
   if (!document_information.creation_date.empty())
-    out_stream << "   /CreationDate (" << document_information.creation_date << ")\n";
+    object << "   /CreationDate (" << document_information.creation_date << ")\n";
   if (!document_information.mod_date.empty())
-    out_stream << "   /ModDate (" << document_information.mod_date << ")\n";
-  out_stream << ">>\nendobj\n";
+    object << "   /ModDate (" << document_information.mod_date << ")\n";
+  object << ">>";
+  writer->write_object(5, object.str());
 
   return out_stream;
 }
 
 std::ostream& Document::write_objects(std::ostream &out_stream)
 {
-  // We keep track of the next object number to be written.
-  unsigned written_body_objects = 0;
+  write_preamble(out_stream);
+  write_body_objects(out_stream,
+                     0,
+                     first_body_object_number + preamble_objects());
+
+  if (serialization_threads > 1 && pages.size() > 1)
+  {
+    return write_pages_in_parallel(out_stream);
+  }
+
+  // Write the pages.
+  for (auto const &p: pages)
+  {
+    // We write the page to the stream and remember the offset of
+    // each output object.
+    p->to_stream(*writer);
+
+    if (writer->object_stream_full())
+    {
+      write_object_stream();
+    }
+  }
+
+  return out_stream;
+}
+
+std::ostream& Document::write_pages_in_parallel(std::ostream &out_stream)
+{
+  // The output of a page: the bytes, the writer that knows where the
+  // objects are in them, and the exception thrown writing them, if any.
+  struct PageBuffer
+  {
+    std::stringstream contents;
+    ObjectWriterPtr page_writer;
+    std::exception_ptr error;
+  };
+
+  size_t n_pages = pages.size();
+  unsigned n_threads = (unsigned)std::min((size_t)serialization_threads,
+                                          n_pages);
+
+  // Workers do not go too far ahead of the pages already copied to the
+  // output, which bounds the memory used by the buffers.
+  size_t window = 4 * n_threads;
+
+  std::vector<std::unique_ptr<PageBuffer> > buffers(n_pages);
+  std::mutex buffers_mutex;
+  std::condition_variable buffers_cv;
+  size_t next_page = 0;
+  size_t copied_pages = 0;
+
+  auto worker = [&]()
+  {
+    for (;;)
+    {
+      size_t i;
+      {
+        std::unique_lock<std::mutex> lock(buffers_mutex);
+        buffers_cv.wait(lock, [&]() {
+          return next_page >= n_pages || next_page < copied_pages + window;
+        });
+        if (next_page >= n_pages)
+        {
+          return;
+        }
+        i = next_page++;
+      }
+
+      // The offsets of the page writer are relative to the buffer.
+      std::unique_ptr<PageBuffer> buffer(new PageBuffer());
+      buffer->page_writer = ObjectWriterPtr(
+        new ObjectWriter(buffer->contents, use_object_streams()));
+      try
+      {
+        pages[i]->to_stream(*buffer->page_writer);
+      }
+      catch (...)
+      {
+        buffer->error = std::current_exception();
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        buffers[i] = std::move(buffer);
+      }
+      buffers_cv.notify_all();
+    }
+  };
+
+  // If the copy below throws, or a thread cannot be started, the workers
+  // are told that no pages are left, which also releases the ones waiting
+  // for the window to move, and joined before the exception leaves.
+  // Otherwise, they have taken all the pages and they are just joined.
+  struct WorkersGuard
+  {
+    std::vector<std::thread> &threads;
+    std::mutex &mutex;
+    std::condition_variable &cv;
+    size_t &next;
+    size_t n;
+
+    ~WorkersGuard()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        next = n;
+      }
+      cv.notify_all();
+      for (auto &t: threads)
+      {
+        if (t.joinable())
+        {
+          t.join();
+        }
+      }
+    }
+  };
+
+  std::vector<std::thread> workers;
+  WorkersGuard guard{workers, buffers_mutex, buffers_cv, next_page, n_pages};
+  for (unsigned t = 0; t < n_threads; ++t)
+  {
+    workers.push_back(std::thread(worker));
+  }
+
+  // Copy the buffers to the output in page order, relocating the offsets
+  // of their objects. After an error, the remaining buffers are dropped.
+  std::exception_ptr error;
+  for (size_t i = 0; i < n_pages; ++i)
+  {
+    std::unique_ptr<PageBuffer> buffer;
+    {
+      std::unique_lock<std::mutex> lock(buffers_mutex);
+      buffers_cv.wait(lock, [&]() { return buffers[i] != nullptr; });
+      buffer = std::move(buffers[i]);
+    }
+
+    if (!error && buffer->error)
+    {
+      error = buffer->error;
+    }
+
+    if (!error)
+    {
+      std::streamoff base = out_stream.tellp();
+      if (buffer->contents.tellp() > 0)
+      {
+        out_stream << buffer->contents.rdbuf();
+      }
+      writer->append(*buffer->page_writer, base);
+
+      if (writer->object_stream_full())
+      {
+        write_object_stream();
+      }
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(buffers_mutex);
+      ++copied_pages;
+    }
+    buffers_cv.notify_all();
+  }
+
+  if (error)
+  {
+    std::rethrow_exception(error);
+  }
+
+  return out_stream;
+}
+
+void Document::write_preamble(std::ostream &out_stream)
+{
+  if (preamble)
+  {
+    std::streamoff base = out_stream.tellp();
+    out_stream.write(preamble->bytes.data(), preamble->bytes.size());
+    writer->add_entries(preamble->entries, base);
+  }
+
+  return;
+}
 
-  for(size_t i = 0; i < body_objects.size(); ++i)
+unsigned Document::write_body_objects(std::ostream &out_stream,
+                                      size_t first_index,
+                                      unsigned object_number)
+{
+  // The objects compressed in the background must be complete.
+  if (compression_executor && first_index < body_objects.size())
   {
-    unsigned body_object_number = first_body_object_number + written_body_objects;
+    compression_executor->wait();
+  }
+
+  // The contents of the objects which are not streams are built in this
+  // buffer, which is reused.
+  std::string contents;
 
+  for(size_t i = first_index; i < body_objects.size(); ++i)
+  {
     // Set the object number if needed.
     if (body_objects[i]->get_type() == PdfObject::Type::FILE_STREAM)
     {
-      std::dynamic_pointer_cast<FileStream>(body_objects[i])->set_object_number(body_object_number);
+      std::dynamic_pointer_cast<FileStream>(body_objects[i])->set_object_number(object_number);
     }
 
-    // Store the object offset before writing it.
-    object_offsets.push_back(out_stream.tellp());
+    if (body_objects[i]->is_stream())
+    {
+      // Store the object offset before writing it.
+      writer->mark_object(object_number);
 
-    // Write the object object.
-    out_stream << body_object_number << " 0 obj\n";
+      // Write the object object.
+      out_stream << object_number << " 0 obj\n";
 
-    body_objects[i]->to_stream(out_stream);
-    out_stream << "\nendobj\n";
+      body_objects[i]->to_stream(out_stream);
+      out_stream << "\nendobj\n";
+    }
+    else
+    {
+      contents.clear();
+      body_objects[i]->append_contents(contents);
+      writer->write_object(object_number, contents);
+    }
 
     if (body_objects[i]->get_type() == PdfObject::Type::FILE_STREAM)
     {
-      // Store the object offset before writing the length object.
-      object_offsets.push_back(out_stream.tellp());
+      FileStreamPtr file_stream =
+        std::dynamic_pointer_cast<FileStream>(body_objects[i]);
+      count_sampling(file_stream->get_sampling(),
+                     file_stream->get_stream_length());
 
       // Write the length object.
-      std::dynamic_pointer_cast<FileStream>(body_objects[i])->length_to_stream(out_stream);
+      writer->write_object(object_number + 1, "   " + util::to_str(
+        file_stream->get_stream_length()));
 
       // We have written two objects here.
-      written_body_objects += 2;
+      object_number += 2;
     }
     else
     {
-      ++written_body_objects;
+      ++object_number;
     }
   }
 
-  // Write the pages.
-  for (auto const &p: pages)
-  {
-    // We write the page to the stream and remember the offset of
-    // each output object.
-    p->to_stream(out_stream, std::back_inserter(object_offsets));
-  }
-
-  return out_stream;
+  return object_number;
 }
 
 std::ostream& Document::write_xref(std::ostream &out_stream)
 {
+  if (use_object_streams())
+  {
+    return write_xref_stream(out_stream);
+  }
+
   // Before writing the cross-reference, we compute its byte offset.
   xref_stream_position = out_stream.tellp();
   xref_stream_position -= start_stream_position;
@@ -476,27 +980,244 @@ std::ostream& Document::write_xref(std::ostream &out_stream)
   // size of the newline and add the space if it uses only one byte.
   out_stream << "xref\n0 " << next_object_number << "\n0000000000 65535 f \n";
 
-  // We use here the object offsets computed so far.
-  for (size_t i = 0; i < object_offsets.size(); ++i)
+  // We use here the object offsets computed so far. Numbers that were
+  // reserved but not written are marked as free.
+  const std::vector<XrefEntry> &entries = writer->get_entries();
+  for (unsigned i = 1; i < next_object_number; ++i)
+  {
+    if (i < entries.size() && entries[i].type == XrefEntry::Type::OFFSET)
+    {
+      // iomanip magic!
+      out_stream << std::setfill('0') << std::setw(10) << entries[i].offset <<
+        " 00000 n \n";
+    }
+    else
+    {
+      out_stream << "0000000000 65535 f \n";
+    }
+  }
+
+  return out_stream;
+}
+
+std::ostream& Document::write_xref_stream(std::ostream &out_stream)
+{
+  // The cross-reference stream is an object itself, the last one.
+  unsigned xref_number = next_object_number++;
+
+  xref_stream_position = out_stream.tellp();
+  xref_stream_position -= start_stream_position;
+  writer->mark_object(xref_number);
+
+  // Each entry has three fields: the type of the entry, the offset or the
+  // number of the object stream, and the index in that object stream.
+  // The second field is as wide as needed for the biggest value.
+  const std::vector<XrefEntry> &entries = writer->get_entries();
+  std::streamoff max_value = 0;
+  for (auto const &e: entries)
+  {
+    max_value = std::max(max_value, e.offset);
+    max_value = std::max(max_value, (std::streamoff)e.stream_number);
+  }
+  unsigned width = 1;
+  while (width < 8 && (max_value >> (8 * width)) > 0)
+  {
+    ++width;
+  }
+
+  std::string table;
+  table.reserve(next_object_number * (width + 3));
+  for (unsigned i = 0; i < next_object_number; ++i)
+  {
+    XrefEntry e;
+    if (i < entries.size())
+    {
+      e = entries[i];
+    }
+
+    std::streamoff field2 = 0;
+    unsigned field3 = 0;
+    switch (e.type)
+    {
+      case XrefEntry::Type::OFFSET:
+        table += (char)1;
+        field2 = e.offset;
+        break;
+      case XrefEntry::Type::COMPRESSED:
+        table += (char)2;
+        field2 = e.stream_number;
+        field3 = e.index;
+        break;
+      default:
+        table += (char)0;
+        field3 = 65535;
+        break;
+    }
+    for (unsigned b = width; b > 0; --b)
+    {
+      table += (char)((field2 >> (8 * (b - 1))) & 0xff);
+    }
+    table += (char)((field3 >> 8) & 0xff);
+    table += (char)(field3 & 0xff);
+  }
+
+  bool use_flate;
+#ifdef PADDLEFISH_USE_ZLIB
+  use_flate = true;
+  table = flate::deflate_string(table, compression_policy);
+#else
+  use_flate = false;
+#endif
+
+  // The cross-reference stream dictionary also plays the role of the
+  // document trailer.
+  out_stream << xref_number << " 0 obj\n<< /Type /XRef\n   /Size " <<
+    next_object_number << "\n   /W [ 1 " << width << " 2 ]\n" <<
+    "   /Root 1 0 R\n   /Info 5 0 R";
+  if (use_flate)
   {
-    // iomanip magic!
-    out_stream << std::setfill('0') << std::setw(10) << object_offsets[i] <<
-      " 00000 n \n";
+    out_stream << "\n   /Filter [ /FlateDecode ]";
   }
+  out_stream << "\n   /Length " << table.size() << "\n>>\nstream\n" <<
+    table << "\nendstream\nendobj\n";
 
   return out_stream;
 }
 
 std::ostream& Document::write_trailer(std::ostream &out_stream)
 {
-  out_stream << "trailer\n<< /Size " << next_object_number << '\n';
-  // The root catalog is at the time being object number 1.
-  out_stream << "   /Root 1 0 R\n   /Info 5 0 R";
-  out_stream << "\n>>\nstartxref\n" << xref_stream_position;
+  // With object streams, the trailer is part of the cross-reference
+  // stream.
+  if (!use_object_streams())
+  {
+    out_stream << "trailer\n<< /Size " << next_object_number << '\n';
+    // The root catalog is at the time being object number 1.
+    out_stream << "   /Root 1 0 R\n   /Info 5 0 R";
+    out_stream << "\n>>\n";
+  }
+  out_stream << "startxref\n" << xref_stream_position;
   out_stream << "\n%%EOF" << std::flush;
   return out_stream;
 }
 
+unsigned Document::share_image(const ImagePtr &image,
+                               const ImagePtr &soft_mask)
+{
+  if (!image_deduplication)
+  {
+    return 0;
+  }
+
+  std::string key = image->get_key();
+  if (soft_mask)
+  {
+    key += '|' + soft_mask->get_key();
+  }
+
+  // Keys are built from hashes, so candidates must be compared: byte by
+  // byte while they are alive, by their digests once they are released.
+  std::string digest;
+  auto image_digest = [&]()
+  {
+    if (digest.empty())
+    {
+      digest = image->get_digest();
+      if (soft_mask && !digest.empty())
+      {
+        std::string mask_digest = soft_mask->get_digest();
+        digest = (mask_digest.empty() ? std::string() :
+                  digest + '|' + mask_digest);
+      }
+    }
+    return digest;
+  };
+
+  auto range = shared_images.equal_range(key);
+  for (auto it = range.first; it != range.second; ++it)
+  {
+    ImagePtr other = it->second.image.lock();
+    ImagePtr other_mask = it->second.soft_mask.lock();
+    if (other && (!soft_mask || other_mask))
+    {
+      if (image->same_contents(*other) &&
+          (!soft_mask || soft_mask->same_contents(*other_mask)))
+      {
+        return it->second.object_number;
+      }
+    }
+    else if (!it->second.digest.empty() &&
+             image_digest() == it->second.digest)
+    {
+      return it->second.object_number;
+    }
+  }
+
+  SharedImage shared;
+  shared.image = image;
+  shared.soft_mask = soft_mask;
+  shared.object_number = image->get_object_number();
+  if (is_streaming())
+  {
+    shared.digest = image_digest();
+  }
+  shared_images.emplace(key, shared);
+
+  return 0;
+}
+
+flate::SamplingStats Document::get_sampling_stats() const
+{
+  flate::SamplingStats stats;
+  stats.sampled = sampled_payloads;
+  stats.stored = stored_payloads;
+  stats.stored_bytes = stored_payload_bytes;
+
+  return stats;
+}
+
+void Document::count_sampling(flate::Sampling sampling, std::uint64_t size)
+{
+  if (sampling != flate::Sampling::NONE)
+  {
+    ++sampled_payloads;
+  }
+  if (sampling == flate::Sampling::STORED)
+  {
+    ++stored_payloads;
+    stored_payload_bytes += size;
+  }
+
+  return;
+}
+
+void Document::set_compression_threads(unsigned threads)
+{
+  if (compression_executor)
+  {
+    compression_executor->wait();
+    compression_executor.reset();
+  }
+  if (threads > 0)
+  {
+    compression_executor = ExecutorPtr(new Executor(threads));
+  }
+
+  return;
+}
+
+unsigned Document::get_compression_threads() const
+{
+  return compression_executor ? compression_executor->get_threads() : 0;
+}
+
+void Document::set_serialization_threads(unsigned threads)
+{
+  serialization_threads = threads ? threads :
+    std::max(1u, std::thread::hardware_concurrency());
+
+  return;
+}
+
 void Document::add_comment(const std::string &comment)
 {
   document_comments.push_back(comment);
@@ -506,7 +1227,13 @@ void Document::add_comment(const std::string &comment)
 
 unsigned Document::add_custom_object(const std::string &object_contents)
 {
-  body_objects.push_back(CustomObjectPtr(new CustomObject(object_contents)));
+  // The user may give a stream here. Streams cannot be packed in object
+  // streams, so we look for the keyword to be on the safe side.
+  bool is_stream = object_contents.find("endstream") != std::string::npos;
+
+  body_objects.push_back(CustomObjectPtr(new CustomObject(object_contents,
+                                                          false,
+                                                          is_stream)));
 
   ++total_body_objects;
 
@@ -522,11 +1249,61 @@ unsigned Document::add_image_resource(const unsigned char *bytes,
                                       unsigned width,
                                       unsigned height,
                                       unsigned colorspace,
-                                      bool flate)
+                                      bool flate,
+                                      const flate::CompressionPolicy *policy)
+{
+  // Pixels deflated on this thread are read before returning, so the
+  // buffers can be borrowed. Otherwise they are kept, and they are copied.
+  bool borrow;
+#ifdef PADDLEFISH_USE_ZLIB
+  borrow = flate && !compression_executor;
+#else
+  borrow = false;
+#endif
+  auto keep = [borrow](const unsigned char *source, size_t size)
+  {
+    if (borrow)
+    {
+      return ImageBuffer(source, [](const unsigned char*) {});
+    }
+    unsigned char *copy = (unsigned char*)malloc(size);
+    if (!copy)
+    {
+      throw std::runtime_error("out of memory copying image pixels");
+    }
+    memcpy(copy, source, size);
+    return ImageBuffer(copy, free);
+  };
+
+  return add_image_resource(
+      keep(bytes, image_width * image_height * channels * (bpc/8)),
+      soft_mask ? keep(soft_mask, image_width * image_height) : ImageBuffer(),
+      bpc,
+      channels,
+      image_width,
+      image_height,
+      width,
+      height,
+      colorspace,
+      flate,
+      policy);
+}
+
+unsigned Document::add_image_resource(const ImageBuffer &bytes,
+                                      const ImageBuffer &soft_mask,
+                                      unsigned bpc,
+                                      unsigned channels,
+                                      unsigned image_width,
+                                      unsigned image_height,
+                                      unsigned width,
+                                      unsigned height,
+                                      unsigned colorspace,
+                                      bool flate,
+                                      const flate::CompressionPolicy *policy)
 {
   // If the image has soft mask, then add first the mask.
   unsigned soft_mask_id = soft_mask ? add_image_resource(soft_mask,
-                                                         NULL,
+                                                         ImageBuffer(),
                                                          8,
                                                          1,
                                                          image_width,
@@ -534,48 +1311,96 @@ unsigned Document::add_image_resource(const unsigned char *bytes,
                                                          width,
                                                          height,
                                                          COLORSPACE_DEVICEGRAY,
-                                                         flate)
+                                                         flate,
+                                                         policy)
                                     : 0;
 
-  // Encode the image contents in a string.
-  std::string image_contents;
-  unsigned contents_size = image_width * image_height * channels * (bpc/8);
-  for (size_t i = 0; i < contents_size; ++i)
-  {
-    image_contents += bytes[i];
-  }
-
-  // Set the flate value and deflate the image if needed.
   bool use_flate;
 #ifdef PADDLEFISH_USE_ZLIB
   use_flate = flate;
-  if (use_flate)
-  {
-    image_contents = flate::deflate_string(image_contents);
-  }
 #else
   use_flate = false;
 #endif
+  flate::CompressionPolicy p = policy ? *policy : compression_policy;
+  bool use_predictors = use_flate && p.predictors && (bpc == 8 || bpc == 16);
+  std::string colorspace_string =
+    colorspace_properties[colorspace].colorspace_string;
+  CustomObjectPtr object(new CustomObject());
+
+  // Build the image object, deflating its contents if needed. Uncompressed
+  // contents are not copied: the object keeps the buffer and writes it
+  // with the document.
+  auto build = [object, bytes, soft_mask_id, bpc, channels, image_width,
+                image_height, colorspace_string, use_flate, use_predictors,
+                p]()
+  {
+    unsigned contents_size = image_width * image_height * channels * (bpc/8);
+    std::string image_contents;
+#ifdef PADDLEFISH_USE_ZLIB
+    if (use_predictors)
+    {
+      std::string filtered;
+      predictor::png_filter(bytes.get(),
+                            image_width * channels * (bpc/8),
+                            image_height,
+                            channels * (bpc/8),
+                            filtered);
+      flate::deflate_cached(filtered.data(), filtered.size(), p,
+                            image_contents);
+    }
+    else if (use_flate)
+    {
+      flate::deflate_cached((const char*)bytes.get(), contents_size, p,
+                            image_contents);
+    }
+#endif
+    size_t stream_size = use_flate ? image_contents.size() : contents_size;
+
+    // Create the contents of the object.
+    std::string object_contents("<< /Type /XObject\n   /Subtype /Image");
+    object_contents += "\n   /Width " + util::to_str(image_width) +
+      "\n   /Height " + util::to_str(image_height) +
+      "\n   /BitsPerComponent " + util::to_str(bpc) +
+      "\n   /ColorSpace " + colorspace_string;
+    if (soft_mask_id)
+    {
+      object_contents += "\n   /SMask " + util::to_str(soft_mask_id) + " 0 R";
+    }
+    if(use_flate)
+    {
+      object_contents += "\n   /Filter [ /FlateDecode ]";
+    }
+    if (use_predictors)
+    {
+      object_contents += "\n   /DecodeParms " +
+        predictor::png_decode_parms(channels, bpc, image_width);
+    }
+    object_contents += "\n   /Length " + util::to_str(stream_size);
+    object_contents += "\n>>";
 
-  // Create the contents of the object.
-  std::string object_contents("<< /Type /XObject\n   /Subtype /Image");
-  object_contents += "\n   /Width " + util::to_str(image_width) +
-    "\n   /Height " + util::to_str(image_height) +
-    "\n   /BitsPerComponent " + util::to_str(bpc) +
-    "\n   /ColorSpace " + colorspace_properties[colorspace].colorspace_string;
-  if (soft_mask)
+    if (use_flate)
+    {
+      object->set_stream(object_contents, std::move(image_contents));
+    }
+    else
+    {
+      object->set_stream(object_contents, bytes, contents_size);
+    }
+  };
+
+  if (use_flate && compression_executor)
   {
-    object_contents += "\n   /SMask " + util::to_str(soft_mask_id) + " 0 R";
+    compression_executor->submit(build);
   }
-  if(use_flate)
+  else
   {
-    object_contents += "\n   /Filter [ /FlateDecode ]";
+    build();
   }
-  object_contents += "\n   /Length " + util::to_str(image_contents.size());
-  object_contents += "\n>>\nstream\n" + image_contents + "\nendstream";
 
   // Add the image object to the document.
-  unsigned object_number = add_custom_object(object_contents);
+  body_objects.push_back(object);
+  ++total_body_objects;
+  unsigned object_number = first_body_object_number + total_body_objects - 1;
 
   // Store the colorspace of the image in the map.
   image_colorspaces.emplace(object_number, colorspace);
@@ -585,45 +1410,91 @@ unsigned Document::add_image_resource(const unsigned char *bytes,
 
 unsigned Document::add_custom_stream(const std::string &strm,
                                      const std::string &extra_header,
-                                     bool flate)
+                                     bool flate,
+                                     const flate::CompressionPolicy *policy)
 {
   return add_custom_stream(strm.c_str(),
                            (unsigned int)strm.length(),
                            extra_header.c_str(),
                            (unsigned int)extra_header.length(),
-                           flate);
+                           flate,
+                           policy);
 }
 
 unsigned Document::add_custom_stream(const char *buffer,
                                      unsigned length,
                                      const char *extra_header,
                                      unsigned extra_headerLength,
-                                     bool flate)
+                                     bool flate,
+                                     const flate::CompressionPolicy *policy)
 {
   bool use_flate;
-
 #ifdef PADDLEFISH_USE_ZLIB
   use_flate = flate;
 #else
   use_flate = false;
 #endif
 
-  std::string stream_contents =
+  CustomObjectPtr object(new CustomObject());
+  flate::CompressionPolicy p = policy ? *policy : compression_policy;
+  std::string header(extra_header, extra_headerLength);
+
+  // Build the stream object from its data, deflating it if needed.
+  auto build = [this, object, p, header, use_flate](const char *data,
+                                                    size_t size)
+  {
+    bool deflate_data = use_flate;
+    std::string stream_contents;
 #ifdef PADDLEFISH_USE_ZLIB
-    use_flate ?
-    flate::deflate_buffer(buffer, length) :
+    if (deflate_data && p.cache)
+    {
+      deflate_data = p.cache->deflate(data, size, p, stream_contents);
+    }
+    // Custom streams often hold data compressed already.
+    else if (deflate_data && p.store_incompressible)
+    {
+      deflate_data = flate::worth_deflating(data, size, p);
+    }
+    if (use_flate && p.store_incompressible)
+    {
+      count_sampling(deflate_data ? flate::Sampling::DEFLATED :
+                                    flate::Sampling::STORED,
+                     size);
+    }
+
+    if (deflate_data && !p.cache)
+    {
+      stream_contents = flate::deflate_buffer(data, (unsigned)size, p);
+    }
 #endif
-    std::string(buffer, length);
+    if (!deflate_data)
+    {
+      stream_contents.assign(data, size);
+    }
+
+    std::string object_contents("<< /Length " +
+      util::to_str(stream_contents.size()) + "\n" +
+      (deflate_data ? "   /Filter [ /FlateDecode ]\n" : "") +
+      (header.empty() ? "" : header + "\n") +
+      ">>");
 
-  std::string object_contents("<< /Length " +
-    util::to_str(stream_contents.size()) + "\n" +
-    (use_flate ? "   /Filter [ /FlateDecode ]\n" : "") +
-    (extra_headerLength ? 
-     std::string(extra_header, extra_headerLength) + "\n" :
-     "") +
-    ">>\nstream\n" + stream_contents + "\nendstream");
+    object->set_stream(object_contents, std::move(stream_contents));
+  };
+
+  // With background compression, the job works on a copy of the data.
+  if (use_flate && compression_executor)
+  {
+    std::shared_ptr<std::string> data(new std::string(buffer, length));
+    compression_executor->submit([build, data]() {
+      build(data->data(), data->size());
+    });
+  }
+  else
+  {
+    build(buffer, length);
+  }
 
-  body_objects.push_back(CustomObjectPtr(new CustomObject(object_contents)));
+  body_objects.push_back(object);
 
   ++total_body_objects;
 
@@ -632,9 +1503,11 @@ unsigned Document::add_custom_stream(const char *buffer,
 
 unsigned Document::add_custom_stream_from_file(const std::string &file_name,
                                                const std::string &extra_header = "",
-                                               bool flate)
+                                               bool flate,
+                                               const flate::CompressionPolicy *policy)
 {
-  body_objects.push_back(FileStreamPtr(new FileStream(file_name, extra_header, flate)));
+  body_objects.push_back(FileStreamPtr(new FileStream(
+    file_name, extra_header, flate, policy ? *policy : compression_policy)));
 
   // The FileStream comprises two objects (stream and length).
   total_body_objects += 2;
@@ -0,0 +1,121 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <paddlefish/executor.h>
+
+#include <utility>
+
+namespace paddlefish {
+
+Executor::Executor(unsigned threads):
+  pending(0),
+  stopping(false)
+{
+  for (unsigned t = 0; t < (threads ? threads : 1); ++t)
+  {
+    workers.push_back(std::thread(&Executor::run, this));
+  }
+}
+
+Executor::~Executor()
+{
+  {
+    std::unique_lock<std::mutex> lock(jobs_mutex);
+    done_cv.wait(lock, [this]() { return pending == 0; });
+    stopping = true;
+  }
+  jobs_cv.notify_all();
+
+  for (auto &w: workers)
+  {
+    w.join();
+  }
+}
+
+void Executor::submit(std::function<void()> job)
+{
+  {
+    std::lock_guard<std::mutex> lock(jobs_mutex);
+    jobs.push_back(std::move(job));
+    ++pending;
+  }
+  jobs_cv.notify_one();
+
+  return;
+}
+
+void Executor::wait()
+{
+  std::exception_ptr job_error;
+  {
+    std::unique_lock<std::mutex> lock(jobs_mutex);
+    done_cv.wait(lock, [this]() { return pending == 0; });
+    std::swap(job_error, error);
+  }
+
+  if (job_error)
+  {
+    std::rethrow_exception(job_error);
+  }
+
+  return;
+}
+
+void Executor::run()
+{
+  for (;;)
+  {
+    std::function<void()> job;
+    {
+      std::unique_lock<std::mutex> lock(jobs_mutex);
+      jobs_cv.wait(lock, [this]() { return stopping || !jobs.empty(); });
+      if (jobs.empty())
+      {
+        return;
+      }
+      job = std::move(jobs.front());
+      jobs.pop_front();
+    }
+
+    std::exception_ptr job_error;
+    try
+    {
+      job();
+    }
+    catch (...)
+    {
+      job_error = std::current_exception();
+    }
+    // The job is destroyed before it counts as done, so that the buffers
+    // it holds are released by then.
+    job = nullptr;
+
+    {
+      std::lock_guard<std::mutex> lock(jobs_mutex);
+      if (job_error && !error)
+      {
+        error = job_error;
+      }
+      --pending;
+    }
+    done_cv.notify_all();
+  }
+}
+
+} // namespace paddlefish
+
+// vim: ts=2:sw=2:expandtab
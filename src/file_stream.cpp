@@ -15,6 +15,7 @@
 // You should have received a copy of the GNU General Public License
 // along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <paddlefish/compression_cache.h>
 #include <paddlefish/file_stream.h>
 #include <paddlefish/flate.h>
 #include <paddlefish/util.h>
@@ -26,8 +27,13 @@ namespace paddlefish {
 
 FileStream::FileStream(const std::string& filename,
                        const std::string& extra_header,
-                       bool flate):
-  filename(filename), object_number(0), stream_length(0)
+                       bool flate,
+                       const flate::CompressionPolicy &policy):
+  filename(filename),
+  compression_policy(policy),
+  object_number(0),
+  stream_length(0),
+  sampling(flate::Sampling::NONE)
 {
 #ifdef PADDLEFISH_USE_ZLIB
   use_flate = flate;
@@ -35,13 +41,6 @@ FileStream::FileStream(const std::string& filename,
   use_flate = false;
 #endif
 
-  header = "<< ";
-
-  if (use_flate)
-  {
-    header += "/Filter [/FlateDecode]\n   ";
-  }
-
   if (extra_header != std::string())
   {
     header += extra_header + "\n   ";
@@ -50,20 +49,56 @@ FileStream::FileStream(const std::string& filename,
 
 std::ostream& FileStream::to_stream(std::ostream& os) const
 {
+  // The file is sampled now, since it may not exist when the stream is
+  // added.
+  bool deflate_data = use_flate;
+  // With a cache, the file is deflated, or found, before being written.
+  std::string deflated;
+  bool cached = false;
+#ifdef PADDLEFISH_USE_ZLIB
+  if (use_flate && compression_policy.cache)
+  {
+    deflate_data = compression_policy.cache->deflate_file(filename,
+                                                          compression_policy,
+                                                          deflated);
+    cached = deflate_data;
+    if (compression_policy.store_incompressible)
+    {
+      sampling = deflate_data ? flate::Sampling::DEFLATED :
+                                flate::Sampling::STORED;
+    }
+  }
+  else if (use_flate && compression_policy.store_incompressible)
+  {
+    deflate_data = flate::file_worth_deflating(filename, compression_policy);
+    sampling = deflate_data ? flate::Sampling::DEFLATED :
+                              flate::Sampling::STORED;
+  }
+#endif
+
   // We complete the header here. We couldn't do it before because the object
   // number was not computed at construction time.
+  os << "<< ";
+  if (deflate_data)
+  {
+    os << "/Filter [/FlateDecode]\n   ";
+  }
   os << header << "/Length " << util::to_str(object_number + 1) << " 0 R\n>>"
     << "\nstream\n";
   
   auto lStreamStart = os.tellp();
 
+  if (cached)
+  {
+    os.write(deflated.data(), deflated.size());
+  }
 #ifdef PADDLEFISH_USE_ZLIB
-  if (use_flate)
+  else if (deflate_data)
   {
-    flate::deflate_file_to_stream(os, filename);
+    flate::deflate_file_to_stream(os, filename, compression_policy);
   }
-  else
 #endif
+  else
   {
     // Open the input file.
     std::ifstream lFile(filename, std::ios_base::in | std::ios_base::binary);
@@ -88,13 +123,15 @@ std::ostream& FileStream::to_stream(std::ostream& os) const
   return os;
 }
 
-const std::string FileStream::get_contents() const
+void FileStream::append_contents(std::string &buffer) const
 {
   std::stringstream ss;
 
   to_stream(ss);
 
-  return ss.str();
+  buffer += ss.str();
+
+  return;
 }
 
 std::ostream& FileStream::length_to_stream(std::ostream& os) const
@@ -17,89 +17,360 @@
 
 #include <paddlefish/flate.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cstdio>
 #include <cstring>
+#include <exception>
+#include <mutex>
 #include <stdexcept>
+#include <thread>
+#include <vector>
+
+#ifdef PADDLEFISH_USE_ZLIB
+#ifdef PADDLEFISH_ZLIB_NG
+// zlib-ng without zlib compatibility has the zlib API with the zng_ prefix.
+#include <zlib-ng.h>
+#define z_stream zng_stream
+#define deflateInit2 zng_deflateInit2
+#define deflate zng_deflate
+#define deflateEnd zng_deflateEnd
+#define deflateReset zng_deflateReset
+#define deflateBound zng_deflateBound
+#define deflateSetDictionary zng_deflateSetDictionary
+#define inflateInit zng_inflateInit
+#define inflate zng_inflate
+#define inflateEnd zng_inflateEnd
+#define inflateReset zng_inflateReset
+#define adler32 zng_adler32
+#define adler32_combine zng_adler32_combine
+#define compressBound zng_compressBound
+#else
+#include <zlib.h>
+#endif
+#ifdef PADDLEFISH_USE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+#endif
 
 namespace paddlefish {
 namespace flate{
 
+bool backend_available(CompressionPolicy::Backend backend)
+{
+  switch (backend)
+  {
+    case CompressionPolicy::Backend::LIBDEFLATE:
+#ifdef PADDLEFISH_USE_LIBDEFLATE
+      return true;
+#else
+      return false;
+#endif
+    default:
 #ifdef PADDLEFISH_USE_ZLIB
+      return true;
+#else
+      return false;
+#endif
+  }
+}
 
-#include <zlib.h>
+std::string backend_name(CompressionPolicy::Backend backend)
+{
+#ifdef PADDLEFISH_ZLIB_NG
+  std::string zlib_name("zlib-ng");
+#else
+  std::string zlib_name("zlib");
+#endif
+
+  switch (backend)
+  {
+    case CompressionPolicy::Backend::ZLIB:
+      return zlib_name;
+    case CompressionPolicy::Backend::LIBDEFLATE:
+      return "libdeflate";
+    default:
+#ifdef PADDLEFISH_USE_LIBDEFLATE
+      return "libdeflate and " + zlib_name;
+#else
+      return zlib_name;
+#endif
+  }
+}
+
+#ifdef PADDLEFISH_USE_ZLIB
 
 #define CHUNK 16384
 
-std::string deflate_string(const std::string& str)
+// The allocations made by zlib, counted for zlib_allocations().
+static std::atomic<unsigned long> allocations(0);
+
+static void *counting_alloc(void*, unsigned items, unsigned size)
+{
+  ++allocations;
+  return malloc((size_t)items * size);
+}
+
+static void counting_free(void*, void *address)
 {
-  return deflate_buffer(str.c_str(), (unsigned)str.size());
+  free(address);
+  return;
 }
 
-// Based on http://panthema.net/2007/0328-ZLibString.html
-// See license at http://www.boost.org/LICENSE_1_0.txt
-std::string deflate_buffer(const char *buffer, unsigned length)
+unsigned long zlib_allocations()
 {
-  z_stream z_str;
-  memset(&z_str, 0, sizeof(z_str));
+  return allocations;
+}
 
-  deflateInit(&z_str, Z_BEST_COMPRESSION);
-  z_str.next_in = (Bytef*)buffer;
-  z_str.avail_in = length;
+// Initialize a deflate stream with the given policy. A raw stream has no
+// zlib header nor trailer.
+static int init_deflate(z_stream *strm,
+                        const CompressionPolicy &policy,
+                        bool raw = false)
+{
+  int strategy;
+  switch (policy.strategy)
+  {
+    case CompressionPolicy::Strategy::FILTERED:
+      strategy = Z_FILTERED;
+      break;
+    case CompressionPolicy::Strategy::HUFFMAN_ONLY:
+      strategy = Z_HUFFMAN_ONLY;
+      break;
+    case CompressionPolicy::Strategy::RLE:
+      strategy = Z_RLE;
+      break;
+    case CompressionPolicy::Strategy::FIXED:
+      strategy = Z_FIXED;
+      break;
+    default:
+      strategy = Z_DEFAULT_STRATEGY;
+      break;
+  }
 
-  int ret_value;
+  // Other window sizes produce raw or gzip streams, which are not valid
+  // for the flate filter.
+  if (policy.window_bits < 9 || policy.window_bits > 15)
+  {
+    throw std::runtime_error("invalid window bits in compression policy");
+  }
 
-  // We allocate for output the input size.
-  // TODO: if this size doesn't work, then inform it so the
-  // user writes the data without using flate method.
-  char *out = (char*)malloc(length * sizeof(char));
+  strm->zalloc = counting_alloc;
+  strm->zfree = counting_free;
+  strm->opaque = Z_NULL;
+  int ret = deflateInit2(strm,
+                         policy.level,
+                         Z_DEFLATED,
+                         raw ? -policy.window_bits : policy.window_bits,
+                         policy.mem_level,
+                         strategy);
+  if (ret != Z_OK)
+  {
+    throw std::runtime_error("invalid compression policy");
+  }
 
-  std::string retstr;
-  retstr.reserve(length);
+  return ret;
+}
 
-  do {
-    z_str.next_out = reinterpret_cast<Bytef*>(out);
-    z_str.avail_out = sizeof(out);
-    ret_value = deflate(&z_str, Z_FINISH);
-    if (retstr.size()<z_str.total_out)
-      retstr.append(out, z_str.total_out - retstr.size());
-  } while (Z_OK == ret_value);
+// The two bytes of the zlib header, computed as deflate() does.
+static void zlib_header(const CompressionPolicy &policy, unsigned char *header)
+{
+  unsigned level_flags;
+  if (policy.strategy == CompressionPolicy::Strategy::HUFFMAN_ONLY ||
+      policy.strategy == CompressionPolicy::Strategy::RLE ||
+      policy.strategy == CompressionPolicy::Strategy::FIXED ||
+      (policy.level >= 0 && policy.level < 2))
+  {
+    level_flags = 0;
+  }
+  else if (policy.level >= 0 && policy.level < 6)
+  {
+    level_flags = 1;
+  }
+  else if (policy.level < 0 || policy.level == 6)
+  {
+    level_flags = 2;
+  }
+  else
+  {
+    level_flags = 3;
+  }
 
-  deflateEnd(&z_str);
+  unsigned h = (Z_DEFLATED + ((policy.window_bits - 8) << 4)) << 8;
+  h |= level_flags << 6;
+  h += 31 - (h % 31);
+  header[0] = (unsigned char)(h >> 8);
+  header[1] = (unsigned char)(h & 0xff);
 
-  return retstr;
+  return;
 }
 
-// Based on http://panthema.net/2007/0328-ZLibString.html
-// See license at http://www.boost.org/LICENSE_1_0.txt
-std::string inflate_string(const std::string& deflated,
-                           unsigned times_out_alloc){
-    z_stream z_str;
+// Deflate the input in blocks of PARALLEL_BLOCK_SIZE bytes, on several
+// threads. Each block is a raw deflate stream primed with the end of the
+// previous block as dictionary, and ended with a sync flush (except the
+// last one), so that the blocks can be joined. The zlib header and the
+// Adler-32 of the whole input, combined from the ones of the blocks, wrap
+// them. The result goes to the string, if not null, or to the stream.
+static size_t parallel_deflate(const char *data,
+                               size_t size,
+                               const CompressionPolicy &policy,
+                               std::string *out_string,
+                               std::ostream *out_stream)
+{
+  size_t blocks = (size + PARALLEL_BLOCK_SIZE - 1) / PARALLEL_BLOCK_SIZE;
+  size_t window = (size_t)1 << policy.window_bits;
 
-    memset(&z_str,0,sizeof(z_str));
-    inflateInit(&z_str);
-    z_str.next_in=(Bytef*)deflated.c_str();
-    z_str.avail_in=(uInt)deflated.size();
+  std::vector<std::string> compressed(blocks);
+  std::vector<unsigned long> checksums(blocks);
+  std::atomic<size_t> next_block(0);
+  std::exception_ptr error;
+  std::mutex error_mutex;
 
-    int ret_value;
+  auto worker = [&]()
+  {
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    try
+    {
+      init_deflate(&strm, policy, true);
+      size_t b;
+      while ((b = next_block++) < blocks)
+      {
+        size_t start = b * PARALLEL_BLOCK_SIZE;
+        size_t length = std::min(PARALLEL_BLOCK_SIZE, size - start);
+        const unsigned char *in = (const unsigned char*)data + start;
+
+        deflateReset(&strm);
+        if (b > 0)
+        {
+          size_t dictionary = std::min(window, start);
+          deflateSetDictionary(&strm, in - dictionary, (unsigned)dictionary);
+        }
+
+        std::string &out = compressed[b];
+        // The bound leaves room for the marker of the sync flush.
+        out.resize(deflateBound(&strm, (unsigned long)length) + 16);
+        strm.next_in = (unsigned char*)in;
+        strm.avail_in = (unsigned)length;
+        strm.next_out = reinterpret_cast<unsigned char*>(&out[0]);
+        strm.avail_out = (unsigned)out.size();
+        int ret = ::deflate(&strm, b + 1 == blocks ? Z_FINISH : Z_SYNC_FLUSH);
+        if (ret == Z_STREAM_ERROR || strm.avail_in != 0 ||
+            strm.avail_out == 0 ||
+            (b + 1 == blocks && ret != Z_STREAM_END))
+        {
+          throw std::runtime_error("error deflating data");
+        }
+        out.resize(out.size() - strm.avail_out);
+
+        checksums[b] = adler32(1L, in, (unsigned)length);
+      }
+    }
+    catch (...)
+    {
+      std::lock_guard<std::mutex> lock(error_mutex);
+      if (!error)
+      {
+        error = std::current_exception();
+      }
+      next_block = blocks;
+    }
+    (void)deflateEnd(&strm);
+  };
 
-    // We allocate for output times_out_alloc times the input size.
-    // TODO: if this size doesn't work, rerun with a bigger parameter
-    char *out=(char*)malloc(times_out_alloc*deflated.size()*sizeof(char));
+  unsigned threads = policy.threads ? policy.threads :
+    std::max(1u, std::thread::hardware_concurrency());
+  if (threads > blocks)
+  {
+    threads = (unsigned)blocks;
+  }
+  std::vector<std::thread> pool;
+  for (unsigned t = 1; t < threads; ++t)
+  {
+    pool.push_back(std::thread(worker));
+  }
+  worker();
+  for (size_t t = 0; t < pool.size(); ++t)
+  {
+    pool[t].join();
+  }
+  if (error)
+  {
+    std::rethrow_exception(error);
+  }
 
-    std::string retstr;
-    retstr.reserve(deflated.size());
+  unsigned char header[2];
+  zlib_header(policy, header);
 
-    do{
-        z_str.next_out=reinterpret_cast<Bytef*>(out);
-        z_str.avail_out=sizeof(out);
-        ret_value=inflate(&z_str,0);
-        if(retstr.size()<z_str.total_out)
-            retstr.append(out,z_str.total_out-retstr.size());
-    }while(Z_OK==ret_value);
+  unsigned long checksum = checksums[0];
+  for (size_t b = 1; b < blocks; ++b)
+  {
+    size_t length = std::min(PARALLEL_BLOCK_SIZE,
+                             size - b * PARALLEL_BLOCK_SIZE);
+    checksum = adler32_combine(checksum, checksums[b], length);
+  }
+  unsigned char trailer[4] = {
+    (unsigned char)(checksum >> 24),
+    (unsigned char)(checksum >> 16),
+    (unsigned char)(checksum >> 8),
+    (unsigned char)checksum
+  };
+
+  size_t written = sizeof(header) + sizeof(trailer);
+  for (size_t b = 0; b < blocks; ++b)
+  {
+    written += compressed[b].size();
+  }
+
+  if (out_string)
+  {
+    out_string->reserve(out_string->size() + written);
+    out_string->append(reinterpret_cast<char*>(header), sizeof(header));
+    for (size_t b = 0; b < blocks; ++b)
+    {
+      out_string->append(compressed[b]);
+    }
+    out_string->append(reinterpret_cast<char*>(trailer), sizeof(trailer));
+  }
+  else
+  {
+    out_stream->write(reinterpret_cast<char*>(header), sizeof(header));
+    for (size_t b = 0; b < blocks; ++b)
+    {
+      out_stream->write(compressed[b].data(), compressed[b].size());
+    }
+    out_stream->write(reinterpret_cast<char*>(trailer), sizeof(trailer));
+  }
+
+  return written;
+}
+
+std::string deflate_string(const std::string& str,
+                           const CompressionPolicy &policy)
+{
+  return deflate_buffer(str.c_str(), (unsigned)str.size(), policy);
+}
 
-    inflateEnd(&z_str);
+std::string deflate_buffer(const char *buffer,
+                           unsigned length,
+                           const CompressionPolicy &policy)
+{
+  std::string retstr;
+  PooledDeflater(policy)->compress(buffer, length, retstr);
 
-    return retstr;
+  return retstr;
+}
+
+std::string inflate_string(const std::string& deflated,
+                           unsigned times_out_alloc)
+{
+  std::string retstr;
+  Inflater().decompress(deflated.data(),
+                        deflated.size(),
+                        retstr,
+                        (size_t)times_out_alloc * deflated.size());
+
+  return retstr;
 }
 
 // Based on zpipe.c (the example coming with zlib sources). We handle files
@@ -107,7 +378,8 @@ std::string inflate_string(const std::string& deflated,
 // basic_istream.write() is not overloaded for char*, as the operators << and
 // >> are.
 std::ostream& deflate_file_to_stream(std::ostream& out_stream,
-                                     const std::string& filename)
+                                     const std::string& filename,
+                                     const CompressionPolicy &policy)
 {
 #ifdef PADDLEFISH_WINDOWS
   FILE *source;
@@ -121,107 +393,521 @@ std::ostream& deflate_file_to_stream(std::ostream& out_stream,
     throw std::runtime_error("error opening file \"" + filename + "\"");
   }
 
-  int ret, flush;
-  unsigned have;
+  char in[CHUNK];
+  PooledDeflater deflater(policy);
+  deflater->begin(out_stream);
+  size_t have;
+  do {
+    have = fread(in, 1, CHUNK, source);
+    if (ferror(source))
+    {
+      fclose(source);
+      throw std::runtime_error("Z_ERRNO deflating file \"" + filename + "\"");
+    }
+    deflater->write(in, have);
+  } while (have == CHUNK);
+  deflater->finish();
+
+  fclose(source);
+
+  return out_stream;
+}
+
+std::ostream& deflate_buffer_to_stream(std::ostream& out_stream,
+                                       char* buffer,
+                                       unsigned length,
+                                       const CompressionPolicy &policy)
+{
+  PooledDeflater(policy)->compress(buffer, length, out_stream);
+
+  return out_stream;
+}
+
+// The input size of zlib is 32 bits, so bigger inputs are given to it in
+// pieces of this size.
+static const size_t MAX_Z_INPUT = 0x40000000;
+
+struct Deflater::State
+{
   z_stream strm;
-  unsigned char in[CHUNK];
-  unsigned char out[CHUNK];
+  CompressionPolicy policy;
+  // The output of single pass compressions, when it goes to a stream.
+  std::string scratch;
+  // The ring for chunked compressions.
+  unsigned char chunk[CHUNK_SIZE];
+  bool used;
+  // The output and the compressed size, between begin() and finish().
+  std::ostream *out;
+  size_t written;
+#ifdef PADDLEFISH_USE_LIBDEFLATE
+  // The libdeflate compressor, allocated when first used.
+  struct libdeflate_compressor *compressor;
+#endif
+};
 
-  strm.zalloc = Z_NULL;
-  strm.zfree = Z_NULL;
-  strm.opaque = Z_NULL;
-  ret = deflateInit(&strm, Z_BEST_COMPRESSION);
-  if (ret != Z_OK)
+Deflater::Deflater(const CompressionPolicy &policy):
+  state(new State())
+{
+  state->used = false;
+  state->policy = policy;
+  state->out = nullptr;
+  state->written = 0;
+#ifdef PADDLEFISH_USE_LIBDEFLATE
+  state->compressor = nullptr;
+#endif
+  init_deflate(&state->strm, policy);
+}
+
+Deflater::~Deflater()
+{
+  (void)deflateEnd(&state->strm);
+#ifdef PADDLEFISH_USE_LIBDEFLATE
+  if (state->compressor)
   {
-    throw std::runtime_error("error deflating file \"" + filename + "\"");
+    libdeflate_free_compressor(state->compressor);
   }
+#endif
+}
 
+// Compress size bytes at data. The compressed bytes are appended to the
+// string, if it is not null, or else written to the stream.
+static size_t run_deflate(z_stream *strm,
+                          const char *data,
+                          size_t size,
+                          unsigned char *chunk,
+                          std::string *out_string,
+                          std::ostream *out_stream)
+{
+  size_t written = 0;
+  int ret;
   do {
-    strm.avail_in = (uInt)fread(in, 1, CHUNK, source);
-    if (ferror(source))
+    unsigned piece = size > MAX_Z_INPUT ? (unsigned)MAX_Z_INPUT : (unsigned)size;
+    int flush = piece == size ? Z_FINISH : Z_NO_FLUSH;
+    strm->next_in = (unsigned char*)data;
+    strm->avail_in = piece;
+    do {
+      strm->next_out = chunk;
+      strm->avail_out = Deflater::CHUNK_SIZE;
+      ret = ::deflate(strm, flush);
+      if (ret == Z_STREAM_ERROR)
+      {
+        throw std::runtime_error("error deflating data");
+      }
+      size_t have = Deflater::CHUNK_SIZE - strm->avail_out;
+      if (out_string)
+      {
+        out_string->append(reinterpret_cast<char*>(chunk), have);
+      }
+      else
+      {
+        out_stream->write(reinterpret_cast<char*>(chunk), have);
+      }
+      written += have;
+    } while (strm->avail_out == 0);
+    data += piece;
+    size -= piece;
+  } while (ret != Z_STREAM_END);
+
+  return written;
+}
+
+// Whether the input is deflated in parallel blocks.
+static bool use_parallel_deflate(size_t size, const CompressionPolicy &policy)
+{
+  return policy.threads != 1 && size >= PARALLEL_MIN_SIZE;
+}
+
+#ifdef PADDLEFISH_USE_LIBDEFLATE
+// Whether whole buffers are compressed with libdeflate. It has no
+// strategies, so a policy with one uses zlib.
+static bool use_libdeflate(const CompressionPolicy &policy)
+{
+  return policy.backend == CompressionPolicy::Backend::LIBDEFLATE ||
+    (policy.backend == CompressionPolicy::Backend::DEFAULT &&
+     policy.strategy == CompressionPolicy::Strategy::DEFAULT);
+}
+
+// Compress the buffer with libdeflate, appending the result to the string.
+static size_t run_libdeflate(struct libdeflate_compressor *compressor,
+                             const char *data,
+                             size_t size,
+                             std::string &out)
+{
+  size_t start = out.size();
+  out.resize(start + libdeflate_zlib_compress_bound(compressor, size));
+  size_t written = libdeflate_zlib_compress(compressor,
+                                            data,
+                                            size,
+                                            &out[start],
+                                            out.size() - start);
+  if (written == 0)
+  {
+    throw std::runtime_error("error deflating data");
+  }
+  out.resize(start + written);
+
+  return written;
+}
+#endif
+
+size_t Deflater::compress(const char *data, size_t size, std::string &out)
+{
+  if (use_parallel_deflate(size, state->policy))
+  {
+    return parallel_deflate(data, size, state->policy, &out, nullptr);
+  }
+
+#ifdef PADDLEFISH_USE_LIBDEFLATE
+  if (use_libdeflate(state->policy))
+  {
+    if (!state->compressor)
     {
-      (void)deflateEnd(&strm);
-      fclose(source);
-      throw std::runtime_error("Z_ERRNO deflating file \"" + filename + "\"");
+      // Level -1 is the default of zlib.
+      int level = state->policy.level < 0 ? 6 : state->policy.level;
+      state->compressor = libdeflate_alloc_compressor(level);
+      if (!state->compressor)
+      {
+        throw std::runtime_error("invalid compression policy");
+      }
     }
-    flush = feof(source) ? Z_FINISH : Z_NO_FLUSH;
-    strm.next_in = in;
+    return run_libdeflate(state->compressor, data, size, out);
+  }
+#endif
 
-    do {
-      strm.avail_out = CHUNK;
-      strm.next_out = out;
-      ret = deflate(&strm, flush);
-      //assert(ret != Z_STREAM_ERROR);
-      have = CHUNK - strm.avail_out;
+  if (state->used)
+  {
+    deflateReset(&state->strm);
+  }
+  state->used = true;
 
-      out_stream.write(reinterpret_cast<char*>(out), have);
-      // TODO: check that the write was successful.
+  if (size > SINGLE_PASS_LIMIT)
+  {
+    return run_deflate(&state->strm, data, size, state->chunk, &out, nullptr);
+  }
 
-    } while (strm.avail_out == 0);
-    //assert(strm.avail_in == 0);
+  // The bound makes a single call enough to finish the stream.
+  size_t start = out.size();
+  out.resize(start + deflateBound(&state->strm, (unsigned long)size));
+  state->strm.next_in = (unsigned char*)data;
+  state->strm.avail_in = (unsigned)size;
+  state->strm.next_out = reinterpret_cast<unsigned char*>(&out[start]);
+  state->strm.avail_out = (unsigned)(out.size() - start);
+  int ret = ::deflate(&state->strm, Z_FINISH);
+  out.resize(start + state->strm.total_out);
+  if (ret != Z_STREAM_END)
+  {
+    throw std::runtime_error("error deflating data");
+  }
 
-  } while (flush != Z_FINISH);
-  //assert(ret == Z_STREAM_END);
+  return state->strm.total_out;
+}
 
-  (void)deflateEnd(&strm);
+size_t Deflater::compress(const char *data, size_t size, std::ostream &out)
+{
+  if (use_parallel_deflate(size, state->policy))
+  {
+    return parallel_deflate(data, size, state->policy, nullptr, &out);
+  }
 
-  fclose(source);
+  if (size > SINGLE_PASS_LIMIT
+#ifdef PADDLEFISH_USE_LIBDEFLATE
+      && !use_libdeflate(state->policy)
+#endif
+     )
+  {
+    if (state->used)
+    {
+      deflateReset(&state->strm);
+    }
+    state->used = true;
+    return run_deflate(&state->strm, data, size, state->chunk, nullptr, &out);
+  }
 
-  return out_stream;
+  state->scratch.clear();
+  size_t written = compress(data, size, state->scratch);
+  out.write(state->scratch.data(), written);
+
+  return written;
 }
 
-std::ostream& deflate_buffer_to_stream(std::ostream& out_stream,
-                                       char* buffer,
-                                       unsigned length)
+void Deflater::begin(std::ostream &out)
 {
-  z_stream z_str;
-  memset(&z_str, 0, sizeof(z_str));
-  deflateInit(&z_str, Z_BEST_COMPRESSION);
-  z_str.next_in = (Bytef*)buffer;
-  z_str.avail_in = length;
-  int ret_value;
+  if (state->used)
+  {
+    deflateReset(&state->strm);
+  }
+  state->used = true;
+  state->out = &out;
+  state->written = 0;
 
-  // We allocate for output the input size.
-  // TODO: if this size doesn't work, then inform it so the
-  // user writes the data without using flate method.
-  char *out = (char*)malloc(length * sizeof(char));
+  return;
+}
 
-  unsigned total_written = 0;
+void Deflater::write(const char *data, size_t size)
+{
+  z_stream *strm = &state->strm;
+  while (size > 0)
+  {
+    unsigned piece = size > MAX_Z_INPUT ? (unsigned)MAX_Z_INPUT : (unsigned)size;
+    strm->next_in = (unsigned char*)data;
+    strm->avail_in = piece;
+    do {
+      strm->next_out = state->chunk;
+      strm->avail_out = CHUNK_SIZE;
+      ::deflate(strm, Z_NO_FLUSH);
+      size_t have = CHUNK_SIZE - strm->avail_out;
+      state->out->write(reinterpret_cast<char*>(state->chunk), have);
+      state->written += have;
+    } while (strm->avail_out == 0);
+    data += piece;
+    size -= piece;
+  }
+
+  return;
+}
 
+size_t Deflater::finish()
+{
+  z_stream *strm = &state->strm;
+  int ret;
+  strm->next_in = Z_NULL;
+  strm->avail_in = 0;
   do {
-    z_str.next_out = reinterpret_cast<Bytef*>(out);
-    z_str.avail_out = sizeof(out);
-    ret_value = deflate(&z_str, Z_FINISH);
+    strm->next_out = state->chunk;
+    strm->avail_out = CHUNK_SIZE;
+    ret = ::deflate(strm, Z_FINISH);
+    size_t have = CHUNK_SIZE - strm->avail_out;
+    state->out->write(reinterpret_cast<char*>(state->chunk), have);
+    state->written += have;
+  } while (ret == Z_OK);
+  state->out = nullptr;
+
+  return state->written;
+}
+
+const CompressionPolicy& Deflater::get_policy() const
+{
+  return state->policy;
+}
+
+// Whether a deflater made for one policy produces the same output as one
+// made for the other.
+static bool same_policy(const CompressionPolicy &a, const CompressionPolicy &b)
+{
+  return a.level == b.level &&
+    a.strategy == b.strategy &&
+    a.mem_level == b.mem_level &&
+    a.window_bits == b.window_bits &&
+    a.threads == b.threads &&
+    a.backend == b.backend;
+}
 
-    if (total_written<z_str.total_out)
+// The deflaters not in use by the calling thread, the last used at the
+// end.
+static thread_local std::vector<std::unique_ptr<Deflater> > deflater_pool;
+static const size_t MAX_POOLED_DEFLATERS = 4;
+
+PooledDeflater::PooledDeflater(const CompressionPolicy &policy)
+{
+  for (size_t i = deflater_pool.size(); i > 0; --i)
+  {
+    if (same_policy(deflater_pool[i - 1]->get_policy(), policy))
     {
-      out_stream.write(out, z_str.total_out - total_written);
-      total_written = z_str.total_out;
+      deflater = std::move(deflater_pool[i - 1]);
+      deflater_pool.erase(deflater_pool.begin() + (i - 1));
+      return;
     }
-  } while (Z_OK == ret_value);
+  }
 
-  deflateEnd(&z_str);
+  deflater.reset(new Deflater(policy));
+}
 
-  return out_stream;
+PooledDeflater::~PooledDeflater()
+{
+  if (deflater_pool.size() == MAX_POOLED_DEFLATERS)
+  {
+    deflater_pool.erase(deflater_pool.begin());
+  }
+  deflater_pool.push_back(std::move(deflater));
 }
 
-unsigned deflate_bound(unsigned aSize)
+struct Inflater::State
+{
+  z_stream strm;
+  unsigned char chunk[Deflater::CHUNK_SIZE];
+  bool used;
+};
+
+Inflater::Inflater():
+  state(new State())
 {
-  return compressBound((uLong)aSize);
+  state->used = false;
+  state->strm.zalloc = counting_alloc;
+  state->strm.zfree = counting_free;
+  if (inflateInit(&state->strm) != Z_OK)
+  {
+    throw std::runtime_error("error initializing zlib");
+  }
+}
+
+Inflater::~Inflater()
+{
+  (void)inflateEnd(&state->strm);
+}
+
+size_t Inflater::decompress(const char *data,
+                            size_t size,
+                            std::string &out,
+                            size_t expected_size)
+{
+  if (state->used)
+  {
+    inflateReset(&state->strm);
+  }
+  state->used = true;
+
+  size_t start = out.size();
+  out.reserve(start + expected_size);
+
+  z_stream *strm = &state->strm;
+  int ret;
+  do {
+    unsigned piece = size > MAX_Z_INPUT ? (unsigned)MAX_Z_INPUT : (unsigned)size;
+    strm->next_in = (unsigned char*)data;
+    strm->avail_in = piece;
+    do {
+      strm->next_out = state->chunk;
+      strm->avail_out = Deflater::CHUNK_SIZE;
+      ret = ::inflate(strm, Z_NO_FLUSH);
+      if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+      {
+        throw std::runtime_error("error inflating data");
+      }
+      out.append(reinterpret_cast<char*>(state->chunk),
+                 Deflater::CHUNK_SIZE - strm->avail_out);
+    } while (strm->avail_out == 0 && ret != Z_STREAM_END);
+    data += piece - strm->avail_in;
+    size -= piece - strm->avail_in;
+  } while (ret != Z_STREAM_END && size > 0);
+
+  if (ret != Z_STREAM_END)
+  {
+    throw std::runtime_error("truncated deflated data");
+  }
+
+  return out.size() - start;
+}
+
+StreamDeflater::StreamDeflater(std::ostream &out_stream,
+                               const CompressionPolicy &policy):
+  deflater(policy),
+  finished(false),
+  written(0)
+{
+  deflater->begin(out_stream);
+}
+
+StreamDeflater::~StreamDeflater()
+{
+}
+
+void StreamDeflater::write(const char *data, size_t size)
+{
+  deflater->write(data, size);
+
+  return;
+}
+
+size_t StreamDeflater::finish()
+{
+  if (!finished)
+  {
+    written = deflater->finish();
+    finished = true;
+  }
+
+  return written;
+}
+
+bool worth_deflating(const char *data,
+                     size_t size,
+                     const CompressionPolicy &policy)
+{
+  if (!policy.store_incompressible)
+  {
+    return true;
+  }
+
+  size_t sample = size < SAMPLE_SIZE ? size : SAMPLE_SIZE;
+  std::string compressed;
+  PooledDeflater(policy)->compress(data, sample, compressed);
+
+  return compressed.size() < policy.store_ratio * sample;
+}
+
+bool file_worth_deflating(const std::string &filename,
+                          const CompressionPolicy &policy)
+{
+  if (!policy.store_incompressible)
+  {
+    return true;
+  }
+
+#ifdef PADDLEFISH_WINDOWS
+  FILE *source;
+  fopen_s(&source, filename.c_str(), "rb");
+#else
+  FILE *source = fopen(filename.c_str(), "rb");
+#endif
+  if (NULL == source)
+  {
+    return true;
+  }
+
+  std::string sample(SAMPLE_SIZE, '\0');
+  sample.resize(fread(&sample[0], 1, SAMPLE_SIZE, source));
+  fclose(source);
+
+  return worth_deflating(sample.data(), sample.size(), policy);
+}
+
+unsigned deflate_bound(unsigned aSize, const CompressionPolicy &policy)
+{
+  // compressBound() is only valid for the default window and memory. For
+  // other values, zlib documents this conservative bound, plus the six
+  // bytes of the zlib wrapper.
+  if (policy.window_bits == 15 && policy.mem_level == 8)
+  {
+    return compressBound((unsigned long)aSize);
+  }
+
+  return aSize + (aSize >> 5) + (aSize >> 7) + (aSize >> 11) + 7 + 6;
 }
 
 unsigned deflate_buffer_to_buffer(const char *src,
                                   unsigned src_length,
                                   char *dst,
-                                  unsigned dst_length)
+                                  unsigned dst_length,
+                                  const CompressionPolicy &policy)
 {
-  compress2(reinterpret_cast<Bytef*>(dst),
-            (uLongf*)&dst_length,
-            reinterpret_cast<const Bytef*>(src),
-            src_length,
-            Z_BEST_COMPRESSION);
+  z_stream strm;
+  memset(&strm, 0, sizeof(strm));
+  init_deflate(&strm, policy);
+
+  strm.next_in = (unsigned char*)src;
+  strm.avail_in = src_length;
+  strm.next_out = reinterpret_cast<unsigned char*>(dst);
+  strm.avail_out = dst_length;
+  int ret = ::deflate(&strm, Z_FINISH);
+  unsigned written = (unsigned)strm.total_out;
+  deflateEnd(&strm);
+
+  if (ret != Z_STREAM_END)
+  {
+    throw std::runtime_error("the deflate output buffer is too small");
+  }
 
-  return dst_length;
+  return written;
 }
 
 #undef CHUNK
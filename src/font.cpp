@@ -36,14 +36,15 @@ const std::string Font::generate_tag()
   return tag;
 }
 
-const std::string Font::get_contents() const
+void Font::append_contents(std::string &contents) const
 {
-  std::string contents = std::string("<< /Type /Font\n   /BaseFont /");
+  contents += "<< /Type /Font\n   /BaseFont /";
 
   // Not sure whether spaces in the name must be converted to #20 or removed.
   // For multiple master fonts (PDF standard 1.4, page 320), spaces must be
   // converted to underscores.
-  contents += util::format_name(get_name()) + "\n";
+  contents += util::format_name(get_name());
+  contents += '\n';
 
   switch(type)
   {
@@ -75,7 +76,7 @@ const std::string Font::get_contents() const
   }
   contents += ">>";
 
-  return contents;
+  return;
 }
 
 std::string Font::get_name() const
@@ -44,23 +44,27 @@ GraphicsState::GraphicsState(unsigned type, double a) :
     }
   }
 
-const std::string GraphicsState::get_contents() const
+void GraphicsState::append_contents(std::string &rContents) const
 {
-  std::string rContents = std::string("<< /Type /ExtGState\n");
- 
+  rContents += "<< /Type /ExtGState\n";
+
   if (has_stroking_alpha)
   {
-    rContents += "   /CA " + util::to_str(stroking_alpha) + "\n";
+    rContents += "   /CA ";
+    rContents += util::to_str(stroking_alpha);
+    rContents += '\n';
   }
 
   if (has_nonstroking_alpha)
   {
-    rContents += "   /ca " + util::to_str(nonstroking_alpha) + "\n";
+    rContents += "   /ca ";
+    rContents += util::to_str(nonstroking_alpha);
+    rContents += '\n';
   }
 
   rContents += "   /AIS false\n>> ";
 
-  return rContents;
+  return;
 }
 
 std::string GraphicsState::to_string()const
@@ -15,13 +15,22 @@
 // You should have received a copy of the GNU General Public License
 // along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <paddlefish/ccitt.h>
+#include <paddlefish/color_profile.h>
 #include <paddlefish/colorspace_properties.h>
 #include <paddlefish/flate.h>
 #include <paddlefish/image.h>
+#include <paddlefish/jpeg.h>
+#include <paddlefish/palette.h>
+#include <paddlefish/png.h>
+#include <paddlefish/predictor.h>
+#include <paddlefish/resample.h>
 #include <paddlefish/util.h>
 
+#include <algorithm>
 #include <cstring>
 #include <fstream>
+#include <stdexcept>
 
 namespace paddlefish {
 
@@ -40,7 +49,9 @@ Image::Image(unsigned x_size,
     image_type(Image::Type::JPEG),
     filename(file),
     colorspace(cs),
-    decode(NULL)
+    decode(NULL),
+    inverted(false),
+    shared(false)
 {
 #ifdef PADDLEFISH_USE_ZLIB
   use_flate = flate;
@@ -75,7 +86,9 @@ Image::Image(unsigned x_size,
     image_type(Image::Type::JPEG),
     filename(file),
     colorspace(cs),
-    decode(NULL)
+    decode(NULL),
+    inverted(false),
+    shared(false)
 {
 #ifdef PADDLEFISH_USE_ZLIB
   use_flate = flate;
@@ -95,6 +108,92 @@ Image::Image(unsigned x_size,
     matrix[i] = matrix23[i];
 }
 
+Image::Image(const ImageBuffer &jpeg_bytes,
+             size_t jpeg_size,
+             double x_pos,
+             double y_pos,
+             double print_width,
+             double print_height,
+             bool flate):
+  decode(NULL),
+  use_soft_mask(false),
+  inverted(false),
+  shared(false)
+{
+#ifdef PADDLEFISH_USE_ZLIB
+  use_flate = flate;
+#else
+  use_flate = false;
+#endif
+
+  set_jpeg(jpeg_bytes, jpeg_size);
+
+  matrix = (double*)malloc(6*sizeof(double));
+  matrix[0] = print_width;
+  matrix[1] = matrix[2] = 0.;
+  matrix[3] = print_height;
+  matrix[4] = x_pos;
+  matrix[5] = y_pos;
+}
+
+Image::Image(const ImageBuffer &jpeg_bytes,
+             size_t jpeg_size,
+             double *matrix23,
+             bool flate):
+  decode(NULL),
+  use_soft_mask(false),
+  inverted(false),
+  shared(false)
+{
+#ifdef PADDLEFISH_USE_ZLIB
+  use_flate = flate;
+#else
+  use_flate = false;
+#endif
+
+  set_jpeg(jpeg_bytes, jpeg_size);
+
+  matrix = (double*)malloc(6 * sizeof(double));
+  for (size_t i = 0; i < 6; ++i)
+    matrix[i] = matrix23[i];
+}
+
+Image::Image(const ImageBuffer &png_bytes,
+             const png::PngInfo &info,
+             double x_pos,
+             double y_pos,
+             double print_width,
+             double print_height):
+  decode(NULL),
+  use_soft_mask(false),
+  inverted(false),
+  shared(false)
+{
+  set_png(png_bytes, info);
+
+  matrix = (double*)malloc(6*sizeof(double));
+  matrix[0] = print_width;
+  matrix[1] = matrix[2] = 0.;
+  matrix[3] = print_height;
+  matrix[4] = x_pos;
+  matrix[5] = y_pos;
+}
+
+Image::Image(const ImageBuffer &png_bytes,
+             const png::PngInfo &info,
+             double *matrix23):
+  decode(NULL),
+  use_soft_mask(false),
+  inverted(false),
+  shared(false)
+{
+  set_png(png_bytes, info);
+
+  matrix = (double*)malloc(6 * sizeof(double));
+  for (size_t i = 0; i < 6; ++i)
+    matrix[i] = matrix23[i];
+}
+
 Image::Image(const unsigned char *raw_bytes,
              bool uses_soft_mask,
              unsigned bits_per_component,
@@ -113,7 +212,9 @@ Image::Image(const unsigned char *raw_bytes,
   filename(""),
   colorspace(cs),
   decode(NULL),
-  use_soft_mask(uses_soft_mask)
+  use_soft_mask(uses_soft_mask),
+  inverted(false),
+  shared(false)
 {
 #ifdef PADDLEFISH_USE_ZLIB
   use_flate = flate;
@@ -122,8 +223,7 @@ Image::Image(const unsigned char *raw_bytes,
 #endif
   image_size[0] = image_width;
   image_size[1] = image_height;
-  stride = (unsigned)ceil((double)(image_size[0] * channels*bpc) / 8.0);
-  raw_size = stride * image_height;
+  set_raw_size();
 
   fill_bytes(raw_bytes);
 
@@ -150,7 +250,9 @@ Image::Image(const unsigned char *raw_bytes,
   filename(""),
   colorspace(cs),
   decode(NULL),
-  use_soft_mask(uses_soft_mask)
+  use_soft_mask(uses_soft_mask),
+  inverted(false),
+  shared(false)
 {
 #ifdef PADDLEFISH_USE_ZLIB
   use_flate = flate;
@@ -160,8 +262,7 @@ Image::Image(const unsigned char *raw_bytes,
 
   image_size[0] = image_width;
   image_size[1] = image_height;
-  stride = (unsigned)ceil((double)(image_size[0] * channels*bpc) / 8.0);
-  raw_size = stride * image_height;
+  set_raw_size();
 
   fill_bytes(raw_bytes);
 
@@ -170,6 +271,116 @@ Image::Image(const unsigned char *raw_bytes,
     matrix[i] = matrix23[i];
 }
 
+Image::Image(const ImageBuffer &raw_bytes,
+             bool uses_soft_mask,
+             unsigned bits_per_component,
+             unsigned number_of_channels,
+             unsigned image_width,
+             unsigned image_height,
+             double x_pos,
+             double y_pos,
+             double print_width,
+             double print_height,
+             unsigned cs,
+             bool flate):
+  bytes(raw_bytes),
+  bpc(bits_per_component),
+  channels(number_of_channels),
+  image_type(Image::Type::RAW),
+  filename(""),
+  colorspace(cs),
+  decode(NULL),
+  use_soft_mask(uses_soft_mask),
+  inverted(false),
+  shared(false)
+{
+#ifdef PADDLEFISH_USE_ZLIB
+  use_flate = flate;
+#else
+  use_flate = false;
+#endif
+  image_size[0] = image_width;
+  image_size[1] = image_height;
+  set_raw_size();
+  bytes_size = raw_size;
+
+  matrix = (double*)malloc(6*sizeof(double));
+  matrix[0] = print_width;
+  matrix[1] = matrix[2] = 0.;
+  matrix[3] = print_height;
+  matrix[4] = x_pos;
+  matrix[5] = y_pos;
+}
+
+Image::Image(const ImageBuffer &raw_bytes,
+             bool uses_soft_mask,
+             unsigned bits_per_component,
+             unsigned number_of_channels,
+             unsigned image_width,
+             unsigned image_height,
+             double *matrix23,
+             unsigned cs,
+             bool flate) :
+  bytes(raw_bytes),
+  bpc(bits_per_component),
+  channels(number_of_channels),
+  image_type(Image::Type::RAW),
+  filename(""),
+  colorspace(cs),
+  decode(NULL),
+  use_soft_mask(uses_soft_mask),
+  inverted(false),
+  shared(false)
+{
+#ifdef PADDLEFISH_USE_ZLIB
+  use_flate = flate;
+#else
+  use_flate = false;
+#endif
+
+  image_size[0] = image_width;
+  image_size[1] = image_height;
+  set_raw_size();
+  bytes_size = raw_size;
+
+  matrix = (double*)malloc(6 * sizeof(double));
+  for (size_t i = 0; i < 6; ++i)
+    matrix[i] = matrix23[i];
+}
+
+Image::Image(const ImageWriterPtr &image_writer,
+             double x_pos,
+             double y_pos,
+             double print_width,
+             double print_height):
+  decode(NULL),
+  use_soft_mask(false),
+  inverted(false),
+  shared(false)
+{
+  set_writer(image_writer);
+
+  matrix = (double*)malloc(6*sizeof(double));
+  matrix[0] = print_width;
+  matrix[1] = matrix[2] = 0.;
+  matrix[3] = print_height;
+  matrix[4] = x_pos;
+  matrix[5] = y_pos;
+}
+
+Image::Image(const ImageWriterPtr &image_writer, double *matrix23):
+  decode(NULL),
+  use_soft_mask(false),
+  inverted(false),
+  shared(false)
+{
+  set_writer(image_writer);
+
+  matrix = (double*)malloc(6 * sizeof(double));
+  for (size_t i = 0; i < 6; ++i)
+    matrix[i] = matrix23[i];
+}
+
 Image::Image(const unsigned char *mask_bytes,
              unsigned image_width,
              unsigned image_height,
@@ -182,7 +393,9 @@ image_type(Image::Type::IMAGE_MASK),
 filename(""),
 colorspace(0), // The colorspace is unused in this kind of image.
 decode(decode_array),
-use_soft_mask(false)
+use_soft_mask(false),
+inverted(false),
+shared(false)
 {
 #ifdef PADDLEFISH_USE_ZLIB
   use_flate = flate;
@@ -192,8 +405,7 @@ use_soft_mask(false)
 
   image_size[0] = image_width;
   image_size[1] = image_height;
-  stride = (unsigned)ceil((double)(image_size[0] * channels*bpc) / 8.0);
-  raw_size = stride * image_height;
+  set_raw_size();
 
   fill_bytes(mask_bytes);
 
@@ -202,30 +414,130 @@ use_soft_mask(false)
     matrix[i] = matrix23[i];
 }
 
-const std::string Image::get_contents() const
+void Image::append_contents(std::string &buffer) const
 {
-  return std::string ("q\n" + util::matrix23_contents_to_string(matrix) +
-    " cm\n/Im" + util::to_str(get_object_number()) + " Do\nQ\n");
+  buffer += "q\n";
+  buffer += util::matrix23_contents_to_string(matrix);
+  buffer += " cm\n/Im";
+  buffer += util::to_str(get_object_number());
+  buffer += " Do\nQ\n";
+
+  return;
 }
 
-unsigned Image::write_image(std::ostream &o, unsigned obj_number)const
+std::uint64_t Image::write_image(std::ostream &o,
+                                 unsigned obj_number,
+                                 const flate::CompressionPolicy &default_policy,
+                                 flate::Sampling *sampling)const
 {
+  if (writer && !writer->is_finished())
+  {
+    throw std::runtime_error("the image writer is not finished");
+  }
+
+  const flate::CompressionPolicy &p = policy ? *policy : default_policy;
+
+  // JPEG data hardly compresses, so the policy may ask to store it.
+  bool deflate_data = use_flate;
+#ifdef PADDLEFISH_USE_ZLIB
+  if (use_flate && image_type == Image::Type::JPEG && p.store_incompressible)
+  {
+    deflate_data = bytes ?
+      flate::worth_deflating(reinterpret_cast<const char*>(bytes.get()),
+                             bytes_size,
+                             p) :
+      flate::file_worth_deflating(filename, p);
+    if (sampling)
+    {
+      *sampling = deflate_data ? flate::Sampling::DEFLATED :
+                                 flate::Sampling::STORED;
+    }
+  }
+#endif
+
+  // Bilevel images may be compressed with CCITT Group 4 instead of flate.
+  bool ccitt_data = deflate_data && uses_ccitt(p);
+
+  // RGB images with few colors, or only grays, are written with fewer
+  // components or fewer bits.
+  palette::Reduction reduction;
+  if (uses_reduction(p))
+  {
+    reduction = palette::analyze(bytes.get(),
+                                 stride,
+                                 image_size[0],
+                                 image_size[1],
+                                 colorspace == COLORSPACE_DEVICERGB);
+  }
+  bool indexed = reduction.type == palette::Reduction::Type::INDEXED;
+  bool reduced = reduction.type != palette::Reduction::Type::NONE;
+
   o << obj_number <<
     " 0 obj\n<< /Type /XObject\n   /Subtype /Image\n" <<
     "   /Name /Im" << get_object_number() <<
-    "\n   /Filter " << get_image_filters() <<
+    "\n   /Filter " << (ccitt_data ? std::string("/CCITTFaxDecode") :
+                                    get_image_filters(deflate_data));
+  if (ccitt_data)
+  {
+    o << "\n   /DecodeParms " <<
+      ccitt::g4_decode_parms(image_size[0], image_size[1]);
+  }
+  else if (image_type == Image::Type::PNG)
+  {
+    o << "\n   /DecodeParms " <<
+      predictor::png_decode_parms(channels, bpc, image_size[0]);
+  }
+  else if (deflate_data && uses_predictors(p) && !indexed)
+  {
+    o << "\n   /DecodeParms " <<
+      predictor::png_decode_parms(reduced ? 1 : channels, bpc, image_size[0]);
+  }
+  o <<
     "\n   /Width " << get_image_width() <<
     "\n   /Height " << get_image_height() <<
-    "\n   /BitsPerComponent " << get_bits_per_component();
+    "\n   /BitsPerComponent " <<
+    (reduced ? reduction.bits_per_component : get_bits_per_component());
   if(image_type == Image::Type::IMAGE_MASK)
   {
     o << "\n   /ImageMask true"
       "\n   /Decode [ " << util::vector_to_string(decode, 2) << " ]";
   }
+  else if (indexed)
+  {
+    o << "\n   /ColorSpace " <<
+      ColorProfile::indexed_array(get_colorspace_string(),
+                                  reduction.colors,
+                                  (unsigned)reduction.colors.size() / 3);
+  }
+  else if (reduced)
+  {
+    o << "\n   /ColorSpace /DeviceGray";
+  }
+  else if (!palette.empty())
+  {
+    o << "\n   /ColorSpace " <<
+      ColorProfile::indexed_array(get_colorspace_string(),
+                                  palette,
+                                  (unsigned)palette.size() / 3);
+  }
   else
   {
     o << "\n   /ColorSpace " << get_colorspace_string();
   }
+  if (!color_key.empty())
+  {
+    o << "\n   /Mask [ " <<
+      util::vector_to_string(color_key.data(), color_key.size()) << " ]";
+  }
+  if (inverted)
+  {
+    o << "\n   /Decode [";
+    for (unsigned i = 0; i < channels; ++i)
+    {
+      o << " 1 0";
+    }
+    o << " ]";
+  }
   // If the image has soft mask, then the soft mask is the next object, after
   // the stream specifying the length.
   if(has_soft_mask())
@@ -233,47 +545,133 @@ unsigned Image::write_image(std::ostream &o, unsigned obj_number)const
     o << "\n   /SMask " << (obj_number + 2) << " 0 R";
   }
   o << "\n   /Length " << (obj_number + 1) << " 0 R\n>>\nstream\n";
-  unsigned written = write_image_stream(o);
+  std::uint64_t written = reduced ?
+    write_reduced(o, p, deflate_data, reduction) :
+    write_image_stream(o, p, deflate_data);
   o << "\nendstream\nendobj\n";
   return written;
 }
 
-// Fills the bytes array with the contents of the image, compressing
-// the stream if needed. This function must be called after setting
-// raw_size.
-void Image::fill_bytes(const unsigned char *source)
+// Computes the length of a row and the size of the pixels of a raw image.
+// This function must be called after setting the size, the channels and the
+// bits per component.
+void Image::set_raw_size()
 {
-#ifdef PADDLEFISH_USE_ZLIB
-  if (use_flate)
+  stride = (unsigned)ceil((double)(image_size[0] * channels*bpc) / 8.0);
+  raw_size = stride * image_size[1];
+
+  return;
+}
+
+// Takes the contents of a JPEG file in memory, and sets the properties of
+// the image from its markers.
+void Image::set_jpeg(const ImageBuffer &jpeg_bytes, size_t jpeg_size)
+{
+  jpeg::JpegInfo info = jpeg::read_info(jpeg_bytes.get(), jpeg_size);
+
+  bytes = jpeg_bytes;
+  bytes_size = (unsigned)jpeg_size;
+  image_type = Image::Type::JPEG;
+  bpc = info.bits_per_component;
+  channels = info.components;
+  colorspace = jpeg::colorspace(info);
+  inverted = jpeg::is_inverted(info);
+  image_size[0] = info.width;
+  image_size[1] = info.height;
+  set_raw_size();
+
+  return;
+}
+
+// Takes the data of a PNG image. A single chunk of data is referenced in
+// the buffer; several chunks are joined in a new one.
+void Image::set_png(const ImageBuffer &png_bytes, const png::PngInfo &info)
+{
+  if (info.data.size() == 1)
   {
-    unsigned bound = flate::deflate_bound(raw_size);
-    bytes = std::shared_ptr<const unsigned char>(
-        (unsigned char*)malloc(bound * sizeof(const unsigned char)), free);
-    bytes_size = flate::deflate_buffer_to_buffer(
-        reinterpret_cast<const char*>(source),
-        raw_size,
-        const_cast<char*>(reinterpret_cast<const char*>(bytes.get())),
-        bound);
+    bytes = ImageBuffer(png_bytes, png_bytes.get() + info.data[0].first);
+    bytes_size = (unsigned)info.data[0].second;
   }
   else
-#endif
   {
-    bytes = std::shared_ptr<const unsigned char>(
-        (unsigned char*)malloc(raw_size * sizeof(const unsigned char)), free);
-    memcpy(const_cast<unsigned char*>(bytes.get()), source, raw_size);
-    bytes_size = raw_size;
+    size_t size = 0;
+    for (size_t i = 0; i < info.data.size(); ++i)
+    {
+      size += info.data[i].second;
+    }
+    unsigned char *joined = (unsigned char*)malloc(size);
+    if (!joined)
+    {
+      throw std::runtime_error("out of memory joining PNG data");
+    }
+    size_t pos = 0;
+    for (size_t i = 0; i < info.data.size(); ++i)
+    {
+      memcpy(joined + pos, png_bytes.get() + info.data[i].first,
+             info.data[i].second);
+      pos += info.data[i].second;
+    }
+    bytes = ImageBuffer(joined, free);
+    bytes_size = (unsigned)size;
   }
 
+  image_type = Image::Type::PNG;
+  // The data is deflated already.
+  use_flate = false;
+  bpc = info.bit_depth;
+  channels = png::components(info);
+  colorspace = png::colorspace(info);
+  palette = info.palette;
+  color_key = info.color_key;
+  image_size[0] = info.width;
+  image_size[1] = info.height;
+  set_raw_size();
+
+  return;
+}
+
+// Takes an image built by a writer. Its size may not fit in the sizes of the
+// other raw images, which are left empty.
+void Image::set_writer(const ImageWriterPtr &image_writer)
+{
+  writer = image_writer;
+  bytes_size = 0;
+  stride = 0;
+  raw_size = 0;
+  image_type = Image::Type::RAW;
+  bpc = writer->get_bits_per_component();
+  channels = writer->get_number_of_channels();
+  colorspace = writer->get_colorspace();
+  use_flate = writer->uses_flate();
+  image_size[0] = writer->get_image_width();
+  image_size[1] = writer->get_image_height();
+
   return;
 }
 
-unsigned Image::write_file_contents(std::ostream &o)const
+// Fills the bytes array with the contents of the image. This function must
+// be called after setting raw_size. The bytes are compressed when written,
+// with the compression policy in effect then, so that an image shared by
+// several pages is compressed only once.
+void Image::fill_bytes(const unsigned char *source)
+{
+  bytes = std::shared_ptr<const unsigned char>(
+      (unsigned char*)malloc(raw_size * sizeof(const unsigned char)), free);
+  memcpy(const_cast<unsigned char*>(bytes.get()), source, raw_size);
+  bytes_size = raw_size;
+
+  return;
+}
+
+unsigned Image::write_file_contents(std::ostream &o,
+                                    const flate::CompressionPolicy &p,
+                                    bool deflate_data)const
 {
 #ifdef PADDLEFISH_USE_ZLIB
-    if(use_flate)
+    if(deflate_data)
     {
       auto start_pos = o.tellp();
-      flate::deflate_file_to_stream(o, filename);
+      flate::deflate_file_to_stream(o, filename, p);
       return (unsigned)(o.tellp() - start_pos);
     }
     else
@@ -288,50 +686,271 @@ unsigned Image::write_file_contents(std::ostream &o)const
     }
 }
 
-unsigned Image::write_bytes(std::ostream &o)const
+unsigned Image::write_bytes(std::ostream &o,
+                            const flate::CompressionPolicy &p,
+                            bool deflate_data)const
 {
-  auto start = o.tellp();
+  if (deflate_data && uses_ccitt(p))
+  {
+    std::string encoded;
+    ccitt::g4_encode(bytes.get(), stride, image_size[0], image_size[1],
+                     encoded);
+    o.write(encoded.data(), encoded.size());
+    return (unsigned)encoded.size();
+  }
+
+  return write_pixels(o, p, deflate_data, bytes.get(), bytes_size, stride,
+                      (channels * bpc + 7) / 8, uses_predictors(p));
+}
 
-  o.write(reinterpret_cast<const char*>(bytes.get()), bytes_size);
-  /*std::string raw_image;
-  for (size_t i = 0; i < raw_size; ++i)
-    raw_image += bytes[i];
-  o << raw_image;*/
+unsigned Image::write_reduced(std::ostream &o,
+                              const flate::CompressionPolicy &p,
+                              bool deflate_data,
+                              const palette::Reduction &reduction)const
+{
+  std::string pixels;
+  palette::reduce(bytes.get(),
+                  stride,
+                  image_size[0],
+                  image_size[1],
+                  reduction,
+                  pixels);
+
+  // Readers differ in how they predict indices, and they hardly help.
+  bool gray = reduction.type == palette::Reduction::Type::GRAY;
+  return write_pixels(o, p, deflate_data,
+                      reinterpret_cast<const unsigned char*>(pixels.data()),
+                      (unsigned)pixels.size(), pixels.size() / image_size[1],
+                      1, gray && uses_predictors(p));
+}
+
+unsigned Image::write_pixels(std::ostream &o,
+                             const flate::CompressionPolicy &p,
+                             bool deflate_data,
+                             const unsigned char *data,
+                             unsigned size,
+                             size_t row_size,
+                             unsigned pixel_size,
+                             bool predict)const
+{
+#ifdef PADDLEFISH_USE_ZLIB
+  if (deflate_data)
+  {
+    flate::PooledDeflater deflater(p);
+    if (predict)
+    {
+      std::string filtered;
+      predictor::png_filter(data, row_size, image_size[1], pixel_size,
+                            filtered);
+      return (unsigned)deflater->compress(filtered.data(), filtered.size(), o);
+    }
+    return (unsigned)deflater->compress(reinterpret_cast<const char*>(data),
+                                        size,
+                                        o);
+  }
+#else
+  (void)p;
+  (void)deflate_data;
+  (void)row_size;
+  (void)pixel_size;
+  (void)predict;
+#endif
 
-  auto end = o.tellp();
+  o.write(reinterpret_cast<const char*>(data), size);
 
-  return (unsigned)(end - start);
+  return size;
 }
 
-unsigned Image::write_image_stream(std::ostream &o)const
+std::uint64_t Image::write_image_stream(std::ostream &o,
+                                        const flate::CompressionPolicy &p,
+                                        bool deflate_data)const
 {
-  unsigned written_bytes;
+  std::uint64_t written_bytes;
+
+  if (writer)
+  {
+    return writer->copy_to(o);
+  }
 
   switch (image_type)
   {
     case Image::Type::JPEG:
-      written_bytes = write_file_contents(o);
+      // JPEG images are given as a file or as a buffer.
+      written_bytes = bytes ? write_bytes(o, p, deflate_data) :
+                              write_file_contents(o, p, deflate_data);
       break;
     default:
-      written_bytes = write_bytes(o);
+      written_bytes = write_bytes(o, p, deflate_data);
       break;
   }
 
   return written_bytes;
 }
 
+bool Image::uses_predictors(const flate::CompressionPolicy &p)const
+{
+  // The writer filtered the rows with its own policy.
+  if (writer)
+  {
+    return writer->uses_predictors();
+  }
+
+  // Readers differ in how they predict components smaller than a byte.
+  return p.predictors && image_type == Image::Type::RAW &&
+    (bpc == 8 || bpc == 16);
+}
+
+bool Image::uses_reduction(const flate::CompressionPolicy &p)const
+{
+  return p.reduce_colors && !writer && image_type == Image::Type::RAW &&
+    bpc == 8 && channels == 3;
+}
+
+bool Image::uses_ccitt(const flate::CompressionPolicy &p)const
+{
+  return p.ccitt_g4 && !writer &&
+    (image_type == Image::Type::IMAGE_MASK ||
+     (image_type == Image::Type::RAW && bpc == 1 && channels == 1));
+}
+
+bool Image::limit_resolution(double max_dpi, resample::Filter filter)
+{
+  if (max_dpi <= 0. || image_type != Image::Type::RAW || bpc != 8 || writer)
+  {
+    return false;
+  }
+
+  // The size at which the image is drawn, in inches, and the number of
+  // pixels it needs at most.
+  double width = std::hypot(matrix[0], matrix[1]) / 72.;
+  double height = std::hypot(matrix[2], matrix[3]) / 72.;
+  unsigned out_width = (unsigned)std::max(
+      1., std::min((double)image_size[0], std::ceil(width * max_dpi)));
+  unsigned out_height = (unsigned)std::max(
+      1., std::min((double)image_size[1], std::ceil(height * max_dpi)));
+  if (out_width == image_size[0] && out_height == image_size[1])
+  {
+    return false;
+  }
+
+  unsigned char *out =
+    (unsigned char*)malloc((size_t)out_width * out_height * channels);
+  if (!out)
+  {
+    throw std::runtime_error("out of memory resampling an image");
+  }
+  resample::resample(bytes.get(), stride, image_size[0], image_size[1],
+                     channels, out, out_width, out_height, filter);
+
+  // The new pixels replace the old ones, which are released now.
+  bytes = ImageBuffer(out, free);
+  image_size[0] = out_width;
+  image_size[1] = out_height;
+  set_raw_size();
+  bytes_size = raw_size;
+
+  return true;
+}
+
 void Image::set_object_number(unsigned n){
         image_object_number=n;
         return;
 }
 
+std::string Image::get_key()const
+{
+  std::string key;
+  if (image_type == Image::Type::JPEG && !bytes)
+  {
+    key = "J " + filename;
+  }
+  else if (writer)
+  {
+    key = "W " + util::to_str((std::uintptr_t)writer.get());
+  }
+  else
+  {
+    key = (image_type == Image::Type::JPEG ? "B " :
+           image_type == Image::Type::IMAGE_MASK ? "M " :
+           image_type == Image::Type::PNG ? "P " : "R ") +
+      util::to_str(util::hash_bytes(bytes.get(), bytes_size)) + ' ' + util::to_str(channels);
+  }
+  if (!palette.empty())
+  {
+    key += " I " + util::to_str(util::hash_bytes(palette.data(),
+                                                 palette.size()));
+  }
+  if (!color_key.empty())
+  {
+    key += " K " + util::vector_to_string(color_key.data(), color_key.size());
+  }
+  key += ' ' + util::to_str(image_size[0]) + ' ' +
+    util::to_str(image_size[1]) + ' ' + util::to_str(bpc) + ' ' +
+    util::to_str(colorspace) + (use_flate ? " F" : " N");
+  if (decode)
+  {
+    key += ' ' + util::vector_to_string(decode, 2);
+  }
+
+  return key;
+}
+
+bool Image::same_contents(const Image &other)const
+{
+  if (image_type != other.image_type)
+  {
+    return false;
+  }
+
+  if (writer || other.writer)
+  {
+    return writer == other.writer;
+  }
+
+  if (image_type == Image::Type::JPEG && (!bytes || !other.bytes))
+  {
+    return !bytes && !other.bytes && filename == other.filename;
+  }
+
+  return bytes_size == other.bytes_size &&
+    palette == other.palette && color_key == other.color_key &&
+    (bytes == other.bytes ||
+     memcmp(bytes.get(), other.bytes.get(), bytes_size) == 0);
+}
+
+std::string Image::get_digest()const
+{
+  if (writer)
+  {
+    return std::string();
+  }
+
+  if (image_type == Image::Type::JPEG && !bytes)
+  {
+    return "J " + filename;
+  }
+
+  std::string digest = util::sha256(bytes.get(), bytes_size);
+  if (!palette.empty())
+  {
+    digest += util::sha256(palette.data(), palette.size());
+  }
+
+  return digest;
+}
+
 std::string Image::get_image_filters()const
+{
+  return get_image_filters(use_flate);
+}
+
+std::string Image::get_image_filters(bool deflate_data)const
 {
   std::string filters("[");
   switch (image_type) {
     case Image::Type::JPEG:
 #ifdef PADDLEFISH_USE_ZLIB
-      if (use_flate)
+      if (deflate_data)
         filters += " /FlateDecode";
 #endif
       filters += " /DCTDecode";
@@ -339,10 +958,14 @@ std::string Image::get_image_filters()const
     case Image::Type::RAW:
     case Image::Type::IMAGE_MASK:
 #ifdef PADDLEFISH_USE_ZLIB
-      if (use_flate)
+      if (deflate_data)
         filters += " /FlateDecode";
 #endif
       break;
+    case Image::Type::PNG:
+      // The data of PNG images is always deflated, even without zlib.
+      filters += " /FlateDecode";
+      break;
     default:
       filters="ERROR";
       throw std::runtime_error("Unrecognized image format for \"" + filename + "\"");
@@ -362,6 +985,9 @@ std::string Image::get_colorspace_string()const
   case COLORSPACE_DEVICEGRAY:
     return "/DeviceGray";
     break;
+  case COLORSPACE_DEVICECMYK:
+    return "/DeviceCMYK";
+    break;
   default:
     return util::to_str(colorspace) + " 0 R";
     break;
@@ -0,0 +1,214 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <paddlefish/image_writer.h>
+#include <paddlefish/predictor.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace paddlefish {
+
+// A sink which appends to a string.
+class StringSink: public Sink
+{
+  public:
+    StringSink(std::string &out_string): out(out_string) {}
+
+  protected:
+    void do_write(const char *data, size_t size)
+    {
+      out.append(data, size);
+      return;
+    }
+
+  private:
+    std::string &out;
+};
+
+ImageWriter::ImageWriter(unsigned image_width,
+                         unsigned image_height,
+                         unsigned bits_per_component,
+                         unsigned number_of_channels,
+                         unsigned cs,
+                         bool flate,
+                         const flate::CompressionPolicy &policy,
+                         Spill spill):
+  width(image_width),
+  height(image_height),
+  bpc(bits_per_component),
+  channels(number_of_channels),
+  colorspace(cs),
+  stride(((size_t)image_width * number_of_channels * bits_per_component + 7) /
+         8),
+  rows_written(0),
+  finished(false),
+  spill_file(nullptr),
+  spill_size(0)
+{
+#ifdef PADDLEFISH_USE_ZLIB
+  use_flate = flate;
+#else
+  use_flate = false;
+  (void)policy;
+#endif
+  // Readers differ in how they predict components smaller than a byte.
+  use_predictors = use_flate && policy.predictors && (bpc == 8 || bpc == 16);
+
+  if (spill == Spill::FILE)
+  {
+    spill_file = std::tmpfile();
+    if (!spill_file)
+    {
+      throw std::runtime_error(std::string("cannot create temporary file: ") +
+                               std::strerror(errno));
+    }
+    spill_sink = std::unique_ptr<Sink>(new FdSink(fileno(spill_file)));
+  }
+  else
+  {
+    spill_sink = std::unique_ptr<Sink>(new StringSink(spill_memory));
+  }
+  spill_stream = std::unique_ptr<std::ostream>(new SinkStream(*spill_sink));
+
+#ifdef PADDLEFISH_USE_ZLIB
+  if (use_flate)
+  {
+    deflater = std::make_shared<flate::Deflater>(policy);
+    deflater->begin(*spill_stream);
+  }
+#endif
+}
+
+ImageWriter::~ImageWriter()
+{
+  spill_stream.reset();
+  spill_sink.reset();
+  if (spill_file)
+  {
+    std::fclose(spill_file);
+  }
+}
+
+void ImageWriter::write_rows(const unsigned char *rows, size_t count)
+{
+  if (finished)
+  {
+    throw std::runtime_error("the image writer is finished");
+  }
+  if (count > height - rows_written)
+  {
+    throw std::runtime_error("too many rows for the image");
+  }
+
+  const char *data = reinterpret_cast<const char*>(rows);
+  size_t size = count * stride;
+  if (use_predictors && count > 0)
+  {
+    filtered.clear();
+    predictor::png_filter(rows,
+                          stride,
+                          count,
+                          (channels * bpc + 7) / 8,
+                          filtered,
+                          rows_written ? previous_row.data() : nullptr);
+    previous_row.assign(rows + (count - 1) * stride, rows + count * stride);
+    data = filtered.data();
+    size = filtered.size();
+  }
+
+#ifdef PADDLEFISH_USE_ZLIB
+  if (use_flate)
+  {
+    deflater->write(data, size);
+  }
+  else
+#endif
+  {
+    spill_stream->write(data, size);
+  }
+  rows_written += (unsigned)count;
+
+  return;
+}
+
+void ImageWriter::finish()
+{
+  if (finished)
+  {
+    return;
+  }
+  if (rows_written != height)
+  {
+    throw std::runtime_error("the image writer got " +
+                             std::to_string(rows_written) + " rows of " +
+                             std::to_string(height));
+  }
+
+#ifdef PADDLEFISH_USE_ZLIB
+  if (use_flate)
+  {
+    deflater->finish();
+    deflater.reset();
+  }
+#endif
+  spill_stream->flush();
+  spill_size = (std::uint64_t)spill_sink->position();
+  spill_stream.reset();
+  spill_sink.reset();
+  std::vector<unsigned char>().swap(previous_row);
+  std::string().swap(filtered);
+  finished = true;
+
+  return;
+}
+
+std::uint64_t ImageWriter::copy_to(std::ostream &o) const
+{
+  if (!finished)
+  {
+    throw std::runtime_error("the image writer is not finished");
+  }
+
+  if (!spill_file)
+  {
+    o.write(spill_memory.data(), spill_memory.size());
+    return spill_size;
+  }
+
+  std::lock_guard<std::mutex> lock(spill_mutex);
+  std::rewind(spill_file);
+  std::vector<char> buffer(1 << 16);
+  std::uint64_t copied = 0;
+  while (copied < spill_size)
+  {
+    size_t n = std::fread(buffer.data(), 1, buffer.size(), spill_file);
+    if (n == 0)
+    {
+      throw std::runtime_error("error reading the temporary image file");
+    }
+    o.write(buffer.data(), n);
+    copied += n;
+  }
+
+  return copied;
+}
+
+} // namespace paddlefish
+
+// vim: ts=2:sw=2:expandtab
@@ -0,0 +1,244 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <paddlefish/interleave.h>
+
+#include <cstring>
+#include <stdexcept>
+
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
+namespace paddlefish {
+namespace interleave {
+
+// The position of the red, green, blue and alpha components in a pixel.
+struct Layout
+{
+  unsigned r, g, b, a;
+  bool premultiplied;
+};
+
+static Layout get_layout(PixelFormat format)
+{
+  switch (format)
+  {
+  case PixelFormat::RGBA:
+    return Layout{ 0, 1, 2, 3, false };
+  case PixelFormat::BGRA:
+    return Layout{ 2, 1, 0, 3, false };
+  case PixelFormat::ARGB:
+    return Layout{ 1, 2, 3, 0, false };
+  case PixelFormat::RGBA_PREMULTIPLIED:
+    return Layout{ 0, 1, 2, 3, true };
+  case PixelFormat::BGRA_PREMULTIPLIED:
+    return Layout{ 2, 1, 0, 3, true };
+  default:
+    return Layout{ 1, 2, 3, 0, true };
+  }
+}
+
+// Splits a pixel with 8-bit components. Premultiplied colors are divided
+// with the reciprocals of the alpha values, in 16.16 fixed point.
+static inline void split_pixel(const unsigned char *p,
+                               const Layout &l,
+                               const std::uint32_t *reciprocal,
+                               unsigned char *color,
+                               unsigned char *alpha)
+{
+  unsigned pa = p[l.a];
+  unsigned rgb[3] = { p[l.r], p[l.g], p[l.b] };
+  if (l.premultiplied && pa != 255)
+  {
+    for (unsigned k = 0; k < 3; ++k)
+    {
+      rgb[k] = (rgb[k] * reciprocal[pa] + 32768) >> 16;
+      rgb[k] = rgb[k] > 255 ? 255 : rgb[k];
+    }
+  }
+  color[0] = (unsigned char)rgb[0];
+  color[1] = (unsigned char)rgb[1];
+  color[2] = (unsigned char)rgb[2];
+  *alpha = (unsigned char)pa;
+
+  return;
+}
+
+// Splits the first pixels of a row with 8-bit components, four at a time,
+// and returns how many were split. Premultiplied pixels are copied as they
+// are when the four are opaque, and divided one by one otherwise. The
+// color stores write 16 bytes, so the last pixels are left to the caller.
+static unsigned split_row_simd(const unsigned char *row,
+                               unsigned width,
+                               const Layout &l,
+                               const std::uint32_t *reciprocal,
+                               unsigned char *color,
+                               unsigned char *alpha,
+                               std::uint32_t &opaque)
+{
+#ifdef __SSSE3__
+  const __m128i color_mask = _mm_setr_epi8(
+      (char)l.r, (char)l.g, (char)l.b,
+      (char)(4 + l.r), (char)(4 + l.g), (char)(4 + l.b),
+      (char)(8 + l.r), (char)(8 + l.g), (char)(8 + l.b),
+      (char)(12 + l.r), (char)(12 + l.g), (char)(12 + l.b),
+      -1, -1, -1, -1);
+  const __m128i alpha_mask = _mm_setr_epi8(
+      (char)l.a, (char)(4 + l.a), (char)(8 + l.a), (char)(12 + l.a),
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+
+  unsigned x = 0;
+  for (; x + 6 <= width; x += 4)
+  {
+    __m128i pixels =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + 4 * x));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(color + 3 * x),
+                     _mm_shuffle_epi8(pixels, color_mask));
+    std::uint32_t a =
+      (std::uint32_t)_mm_cvtsi128_si32(_mm_shuffle_epi8(pixels, alpha_mask));
+    if (l.premultiplied && a != 0xffffffffu)
+    {
+      for (unsigned i = x; i < x + 4; ++i)
+      {
+        split_pixel(row + 4 * i, l, reciprocal, color + 3 * i, alpha + i);
+      }
+    }
+    std::memcpy(alpha + x, &a, 4);
+    opaque &= a;
+  }
+
+  return x;
+#else
+  (void)row;
+  (void)width;
+  (void)l;
+  (void)reciprocal;
+  (void)color;
+  (void)alpha;
+  (void)opaque;
+
+  return 0;
+#endif
+}
+
+static bool split_8(const unsigned char *data,
+                    size_t stride,
+                    unsigned width,
+                    unsigned height,
+                    const Layout &l,
+                    unsigned char *color,
+                    unsigned char *alpha)
+{
+  std::uint32_t reciprocal[256];
+  reciprocal[0] = 0;
+  for (unsigned a = 1; a < 256; ++a)
+  {
+    reciprocal[a] = (255u * 65536u + a / 2) / a;
+  }
+
+  // All the alpha values ANDed, four at a time.
+  std::uint32_t opaque = 0xffffffffu;
+  for (unsigned y = 0; y < height; ++y)
+  {
+    const unsigned char *row = data + y * stride;
+    unsigned char *c = color + (size_t)y * width * 3;
+    unsigned char *a = alpha + (size_t)y * width;
+
+    unsigned x = split_row_simd(row, width, l, reciprocal, c, a, opaque);
+    for (; x < width; ++x)
+    {
+      split_pixel(row + 4 * x, l, reciprocal, c + 3 * x, a + x);
+      opaque &= 0xffffff00u | a[x];
+    }
+  }
+
+  return opaque != 0xffffffffu;
+}
+
+static inline void put_16(unsigned char *out, unsigned v)
+{
+  out[0] = (unsigned char)(v >> 8);
+  out[1] = (unsigned char)v;
+
+  return;
+}
+
+static bool split_16(const unsigned char *data,
+                     size_t stride,
+                     unsigned width,
+                     unsigned height,
+                     const Layout &l,
+                     unsigned char *color,
+                     unsigned char *alpha)
+{
+  bool translucent = false;
+  for (unsigned y = 0; y < height; ++y)
+  {
+    const unsigned char *row = data + y * stride;
+    unsigned char *c = color + (size_t)y * width * 6;
+    unsigned char *a = alpha + (size_t)y * width * 2;
+    for (unsigned x = 0; x < width; ++x)
+    {
+      std::uint16_t p[4];
+      std::memcpy(p, row + 8 * x, 8);
+      unsigned pa = p[l.a];
+      unsigned rgb[3] = { p[l.r], p[l.g], p[l.b] };
+      for (unsigned k = 0; k < 3; ++k)
+      {
+        unsigned v = rgb[k];
+        if (l.premultiplied && pa != 65535)
+        {
+          v = pa ? (unsigned)(((std::uint64_t)v * 65535 + pa / 2) / pa) : 0;
+          v = v > 65535 ? 65535 : v;
+        }
+        put_16(c + 6 * x + 2 * k, v);
+      }
+      put_16(a + 2 * x, pa);
+      translucent = translucent || pa != 65535;
+    }
+  }
+
+  return translucent;
+}
+
+bool split(const unsigned char *data,
+           size_t stride,
+           unsigned width,
+           unsigned height,
+           unsigned bpc,
+           PixelFormat format,
+           unsigned char *color,
+           unsigned char *alpha)
+{
+  Layout l = get_layout(format);
+  switch (bpc)
+  {
+  case 8:
+    return split_8(data, stride, width, height, l, color, alpha);
+  case 16:
+    return split_16(data, stride, width, height, l, color, alpha);
+  default:
+    throw std::runtime_error("interleaved pixels must have 8 or 16 bits "
+                             "per component");
+  }
+}
+
+} // namespace interleave
+} // namespace paddlefish
+
+// vim: ts=2:sw=2:expandtab
@@ -0,0 +1,210 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <paddlefish/colorspace_properties.h>
+#include <paddlefish/jpeg.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#ifdef PADDLEFISH_WINDOWS
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace paddlefish {
+namespace jpeg {
+
+static unsigned read_u16(const unsigned char *p)
+{
+  return ((unsigned)p[0] << 8) | p[1];
+}
+
+// Frame headers are the markers from SOF0 to SOF15, except DHT, JPG and
+// DAC, which share the range.
+static bool is_frame_header(unsigned char marker)
+{
+  return marker >= 0xc0 && marker <= 0xcf &&
+    marker != 0xc4 && marker != 0xc8 && marker != 0xcc;
+}
+
+JpegInfo read_info(const unsigned char *data, size_t size)
+{
+  if (size < 4 || data[0] != 0xff || data[1] != 0xd8)
+  {
+    throw std::runtime_error("not a JPEG image");
+  }
+
+  JpegInfo info;
+  size_t pos = 2;
+  for (;;)
+  {
+    // Markers may be preceded by any number of fill bytes.
+    while (pos < size && data[pos] != 0xff)
+    {
+      ++pos;
+    }
+    while (pos < size && data[pos] == 0xff)
+    {
+      ++pos;
+    }
+    if (pos >= size)
+    {
+      break;
+    }
+    unsigned char marker = data[pos++];
+
+    // Markers without a segment.
+    if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd8))
+    {
+      continue;
+    }
+    if (marker == 0xd9 || marker == 0xda)
+    {
+      break;
+    }
+
+    if (pos + 2 > size)
+    {
+      break;
+    }
+    unsigned length = read_u16(data + pos);
+    if (length < 2 || pos + length > size)
+    {
+      break;
+    }
+    const unsigned char *segment = data + pos + 2;
+    unsigned segment_size = length - 2;
+
+    if (marker == 0xee && segment_size >= 12 &&
+        memcmp(segment, "Adobe", 5) == 0)
+    {
+      info.adobe = true;
+      info.adobe_transform = segment[11];
+    }
+    else if (is_frame_header(marker))
+    {
+      if (segment_size < 6)
+      {
+        break;
+      }
+      info.bits_per_component = segment[0];
+      info.height = read_u16(segment + 1);
+      info.width = read_u16(segment + 3);
+      info.components = segment[5];
+
+      // PDF readers only decode 8-bit JPEG images.
+      if (info.bits_per_component != 8)
+      {
+        throw std::runtime_error("unsupported JPEG precision: " +
+                                 std::to_string(info.bits_per_component));
+      }
+      // The height may be given after the first scan, in a DNL marker.
+      if (info.width == 0 || info.height == 0)
+      {
+        throw std::runtime_error("unsupported JPEG image without size");
+      }
+      if (info.components != 1 && info.components != 3 &&
+          info.components != 4)
+      {
+        throw std::runtime_error("unsupported number of JPEG components: " +
+                                 std::to_string(info.components));
+      }
+
+      return info;
+    }
+
+    pos += length;
+  }
+
+  throw std::runtime_error("JPEG frame header not found");
+}
+
+unsigned colorspace(const JpegInfo &info)
+{
+  switch (info.components)
+  {
+    case 1:
+      return COLORSPACE_DEVICEGRAY;
+    case 4:
+      return COLORSPACE_DEVICECMYK;
+    default:
+      return COLORSPACE_DEVICERGB;
+  }
+}
+
+bool is_inverted(const JpegInfo &info)
+{
+  return info.adobe && info.components == 4;
+}
+
+std::shared_ptr<const unsigned char> read_descriptor(int fd, size_t &size)
+{
+  size_t capacity = 1 << 16;
+  unsigned char *buffer = (unsigned char*)malloc(capacity);
+  if (!buffer)
+  {
+    throw std::runtime_error("out of memory reading descriptor");
+  }
+  size = 0;
+  for (;;)
+  {
+    if (size == capacity)
+    {
+      unsigned char *bigger = (unsigned char*)realloc(buffer, capacity * 2);
+      if (!bigger)
+      {
+        free(buffer);
+        throw std::runtime_error("out of memory reading descriptor");
+      }
+      buffer = bigger;
+      capacity *= 2;
+    }
+
+#ifdef PADDLEFISH_WINDOWS
+    int n = _read(fd, buffer + size, (unsigned)(capacity - size));
+#else
+    ssize_t n = ::read(fd, buffer + size, capacity - size);
+#endif
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      free(buffer);
+      throw std::runtime_error(std::string("error reading descriptor: ") +
+                               std::strerror(errno));
+    }
+    if (n == 0)
+    {
+      break;
+    }
+    size += n;
+  }
+
+  return std::shared_ptr<const unsigned char>(buffer, free);
+}
+
+} // namespace jpeg
+} // namespace paddlefish
+
+// vim: ts=2:sw=2:expandtab
@@ -0,0 +1,155 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <paddlefish/object_writer.h>
+#include <paddlefish/flate.h>
+#include <paddlefish/util.h>
+
+namespace paddlefish {
+
+// The maximum number of objects packed in an object stream.
+#define OBJECT_STREAM_SIZE 100
+
+ObjectWriter::ObjectWriter(std::ostream &out_stream, bool object_streams):
+  out(out_stream),
+  use_object_streams(object_streams)
+{}
+
+void ObjectWriter::mark_object(unsigned object_number)
+{
+  XrefEntry &e = entry(object_number);
+  e.type = XrefEntry::Type::OFFSET;
+  e.offset = out.tellp();
+
+  return;
+}
+
+void ObjectWriter::write_object(unsigned object_number,
+                                const std::string &contents)
+{
+  if (use_object_streams)
+  {
+    pending.push_back(std::make_pair(object_number, contents));
+  }
+  else
+  {
+    mark_object(object_number);
+    out << object_number << " 0 obj\n" << contents << "\nendobj\n";
+  }
+
+  return;
+}
+
+bool ObjectWriter::object_stream_full() const
+{
+  return pending.size() >= OBJECT_STREAM_SIZE;
+}
+
+void ObjectWriter::write_object_stream(unsigned object_number,
+                                       const flate::CompressionPolicy &policy)
+{
+  // The stream starts with pairs of integers, containing the number of
+  // each object and its offset relative to the first object. The objects
+  // come after these pairs.
+  std::string index, objects;
+
+  for (size_t i = 0; i < pending.size(); ++i)
+  {
+    XrefEntry &e = entry(pending[i].first);
+    e.type = XrefEntry::Type::COMPRESSED;
+    e.stream_number = object_number;
+    e.index = (unsigned)i;
+
+    index += util::to_str(pending[i].first) + ' ' +
+      util::to_str(objects.size()) + ' ';
+    objects += pending[i].second + '\n';
+  }
+
+  std::string contents = index + objects;
+
+  bool use_flate;
+#ifdef PADDLEFISH_USE_ZLIB
+  use_flate = true;
+  contents = flate::deflate_string(contents, policy);
+#else
+  use_flate = false;
+#endif
+
+  mark_object(object_number);
+  out << object_number << " 0 obj\n<< /Type /ObjStm\n   /N " <<
+    pending.size() << "\n   /First " << index.size();
+  if (use_flate)
+  {
+    out << "\n   /Filter [ /FlateDecode ]";
+  }
+  out << "\n   /Length " << contents.size() << "\n>>\nstream\n" <<
+    contents << "\nendstream\nendobj\n";
+
+  pending.clear();
+
+  return;
+}
+
+void ObjectWriter::append(ObjectWriter &other, std::streamoff base)
+{
+  add_entries(other.entries, base);
+
+  for (auto &p: other.pending)
+  {
+    pending.push_back(std::move(p));
+  }
+  other.pending.clear();
+
+  return;
+}
+
+void ObjectWriter::add_entries(const std::vector<XrefEntry> &other_entries,
+                               std::streamoff base)
+{
+  for (size_t i = 0; i < other_entries.size(); ++i)
+  {
+    if (other_entries[i].type == XrefEntry::Type::FREE)
+    {
+      continue;
+    }
+
+    XrefEntry &e = entry((unsigned)i);
+    e = other_entries[i];
+    if (e.type == XrefEntry::Type::OFFSET)
+    {
+      e.offset += base;
+    }
+  }
+
+  return;
+}
+
+XrefEntry& ObjectWriter::entry(unsigned object_number)
+{
+  if (entries.size() <= object_number)
+  {
+    entries.resize(object_number + 1);
+  }
+
+  return entries[object_number];
+}
+
+#undef OBJECT_STREAM_SIZE
+
+} // namespace paddlefish
+
+// vim: ts=2:sw=2:expandtab
@@ -17,10 +17,17 @@
 
 #include <paddlefish/colorspace_properties.h>
 #include <paddlefish/document.h>
+#include <paddlefish/flate.h>
+#include <paddlefish/jpeg.h>
 #include <paddlefish/page.h>
+#include <paddlefish/png.h>
 #include <paddlefish/util.h>
 
+#include <algorithm>
+#include <cstdlib>
 #include <memory>
+#include <sstream>
+#include <stdexcept>
 
 namespace paddlefish {
 
@@ -41,6 +48,8 @@ Page::Page()
   has_text = has_commands = false;
   images_count = 0;
 
+  content_flate = ContentFlate::DOCUMENT;
+
   marked_content_nesting_level = 0;
 
   document_ptr = nullptr;
@@ -55,16 +64,14 @@ void Page::add_jpeg_image(const std::string &filename,
                           double height,
                           unsigned cs)
 {
-  page_objects.push_back(ImagePtr(new Image(jpeg_width,
-                                            jpeg_height,
-                                            x_pos,
-                                            y_pos,
-                                            width,
-                                            height,
-                                            filename,
-                                            cs)));
-
-  ++images_count;
+  add_image(ImagePtr(new Image(jpeg_width,
+                               jpeg_height,
+                               x_pos,
+                               y_pos,
+                               width,
+                               height,
+                               filename,
+                               cs)));
 
   return;
 }
@@ -75,13 +82,104 @@ void Page::add_jpeg_image(const std::string &filename,
                           double *matrix23,
                           unsigned cs)
 {
-  page_objects.push_back(ImagePtr(new Image(jpeg_width,
-                                            jpeg_height,
-                                            matrix23,
-                                            filename,
-                                            cs)));
+  add_image(ImagePtr(new Image(jpeg_width,
+                               jpeg_height,
+                               matrix23,
+                               filename,
+                               cs)));
 
-  ++images_count;
+  return;
+}
+
+void Page::add_jpeg_buffer(const ImageBuffer &jpeg,
+                           size_t jpeg_size,
+                           double x_pos,
+                           double y_pos,
+                           double width,
+                           double height)
+{
+  add_image(ImagePtr(new Image(jpeg,
+                               jpeg_size,
+                               x_pos,
+                               y_pos,
+                               width,
+                               height)));
+
+  return;
+}
+
+void Page::add_jpeg_buffer(const ImageBuffer &jpeg,
+                           size_t jpeg_size,
+                           double *matrix23)
+{
+  add_image(ImagePtr(new Image(jpeg, jpeg_size, matrix23)));
+
+  return;
+}
+
+void Page::add_jpeg_descriptor(int fd,
+                               double x_pos,
+                               double y_pos,
+                               double width,
+                               double height)
+{
+  size_t jpeg_size;
+  ImageBuffer jpeg = jpeg::read_descriptor(fd, jpeg_size);
+  add_jpeg_buffer(jpeg, jpeg_size, x_pos, y_pos, width, height);
+
+  return;
+}
+
+void Page::add_jpeg_descriptor(int fd, double *matrix23)
+{
+  size_t jpeg_size;
+  ImageBuffer jpeg = jpeg::read_descriptor(fd, jpeg_size);
+  add_jpeg_buffer(jpeg, jpeg_size, matrix23);
+
+  return;
+}
+
+void Page::add_png_buffer(const ImageBuffer &png,
+                          size_t png_size,
+                          double x_pos,
+                          double y_pos,
+                          double width,
+                          double height)
+{
+  png::PngInfo info = png::read_info(png.get(), png_size);
+  add_image(ImagePtr(new Image(png, info, x_pos, y_pos, width, height)));
+
+  return;
+}
+
+void Page::add_png_buffer(const ImageBuffer &png,
+                          size_t png_size,
+                          double *matrix23)
+{
+  png::PngInfo info = png::read_info(png.get(), png_size);
+  add_image(ImagePtr(new Image(png, info, matrix23)));
+
+  return;
+}
+
+void Page::add_png_descriptor(int fd,
+                              double x_pos,
+                              double y_pos,
+                              double width,
+                              double height)
+{
+  size_t png_size;
+  ImageBuffer png = jpeg::read_descriptor(fd, png_size);
+  add_png_buffer(png, png_size, x_pos, y_pos, width, height);
+
+  return;
+}
+
+void Page::add_png_descriptor(int fd, double *matrix23)
+{
+  size_t png_size;
+  ImageBuffer png = jpeg::read_descriptor(fd, png_size);
+  add_png_buffer(png, png_size, matrix23);
 
   return;
 }
@@ -99,37 +197,33 @@ void Page::add_image_bytes(const unsigned char *bytes,
                            unsigned cs,
                            bool flate)
 {
-  page_objects.push_back(ImagePtr(new Image(bytes,
-                                            (soft_mask != NULL),
-                                            bpp,
-                                            channels,
-                                            image_width,
-                                            image_height,
-                                            x_pos,
-                                            y_pos,
-                                            width,
-                                            height,
-                                            cs,
-                                            flate)));
-
-  ++images_count;
+  add_image(ImagePtr(new Image(bytes,
+                               (soft_mask != NULL),
+                               bpp,
+                               channels,
+                               image_width,
+                               image_height,
+                               x_pos,
+                               y_pos,
+                               width,
+                               height,
+                               cs,
+                               flate)));
 
   if (soft_mask != NULL)
   {
-    page_objects.push_back(ImagePtr(new Image(soft_mask,
-                                              false,
-                                              bpp,
-                                              1,
-                                              image_width,
-                                              image_height,
-                                              x_pos,
-                                              y_pos,
-                                              width,
-                                              height,
-                                              COLORSPACE_DEVICEGRAY,
-                                              flate)));
-
-    ++images_count;
+    add_image(ImagePtr(new Image(soft_mask,
+                                 false,
+                                 bpp,
+                                 1,
+                                 image_width,
+                                 image_height,
+                                 x_pos,
+                                 y_pos,
+                                 width,
+                                 height,
+                                 COLORSPACE_DEVICEGRAY,
+                                 flate)));
   }
 
   return;
@@ -145,32 +239,191 @@ void Page::add_image_bytes(const unsigned char *bytes,
                            unsigned cs,
                            bool flate)
 {
-  page_objects.push_back(ImagePtr(new Image(bytes,
-                                            (soft_mask != NULL),
-                                            bpp,
-                                            channels,
-                                            image_width,
-                                            image_height,
-                                            matrix23,
-                                            cs,
-                                            flate)));
-
-  ++images_count;
+  add_image(ImagePtr(new Image(bytes,
+                               (soft_mask != NULL),
+                               bpp,
+                               channels,
+                               image_width,
+                               image_height,
+                               matrix23,
+                               cs,
+                               flate)));
 
   if (soft_mask != NULL)
   {
-    page_objects.push_back(ImagePtr(new Image(soft_mask,
-                                              false,
-                                              bpp,
-                                              1,
-                                              image_width,
-                                              image_height,
-                                              matrix23,
-                                              COLORSPACE_DEVICEGRAY,
-                                              flate)));
-
-    ++images_count;
+    add_image(ImagePtr(new Image(soft_mask,
+                                 false,
+                                 bpp,
+                                 1,
+                                 image_width,
+                                 image_height,
+                                 matrix23,
+                                 COLORSPACE_DEVICEGRAY,
+                                 flate)));
+  }
+
+  return;
+}
+
+void Page::add_image_buffer(const ImageBuffer &bytes,
+                            const ImageBuffer &soft_mask,
+                            unsigned bpp,
+                            unsigned channels,
+                            unsigned image_width,
+                            unsigned image_height,
+                            double x_pos,
+                            double y_pos,
+                            double width,
+                            double height,
+                            unsigned cs,
+                            bool flate)
+{
+  add_image(ImagePtr(new Image(bytes,
+                               (bool)soft_mask,
+                               bpp,
+                               channels,
+                               image_width,
+                               image_height,
+                               x_pos,
+                               y_pos,
+                               width,
+                               height,
+                               cs,
+                               flate)));
+
+  if (soft_mask)
+  {
+    add_image(ImagePtr(new Image(soft_mask,
+                                 false,
+                                 bpp,
+                                 1,
+                                 image_width,
+                                 image_height,
+                                 x_pos,
+                                 y_pos,
+                                 width,
+                                 height,
+                                 COLORSPACE_DEVICEGRAY,
+                                 flate)));
+  }
+
+  return;
+}
+
+void Page::add_image_buffer(const ImageBuffer &bytes,
+                            const ImageBuffer &soft_mask,
+                            unsigned bpp,
+                            unsigned channels,
+                            unsigned image_width,
+                            unsigned image_height,
+                            double *matrix23,
+                            unsigned cs,
+                            bool flate)
+{
+  add_image(ImagePtr(new Image(bytes,
+                               (bool)soft_mask,
+                               bpp,
+                               channels,
+                               image_width,
+                               image_height,
+                               matrix23,
+                               cs,
+                               flate)));
+
+  if (soft_mask)
+  {
+    add_image(ImagePtr(new Image(soft_mask,
+                                 false,
+                                 bpp,
+                                 1,
+                                 image_width,
+                                 image_height,
+                                 matrix23,
+                                 COLORSPACE_DEVICEGRAY,
+                                 flate)));
+  }
+
+  return;
+}
+
+void Page::add_image_interleaved(const unsigned char *pixels,
+                                 size_t stride,
+                                 interleave::PixelFormat format,
+                                 unsigned bpc,
+                                 unsigned image_width,
+                                 unsigned image_height,
+                                 double x_pos,
+                                 double y_pos,
+                                 double width,
+                                 double height,
+                                 bool flate)
+{
+  double matrix23[] = { width, 0., 0., height, x_pos, y_pos };
+  add_image_interleaved(pixels,
+                        stride,
+                        format,
+                        bpc,
+                        image_width,
+                        image_height,
+                        matrix23,
+                        flate);
+
+  return;
+}
+
+void Page::add_image_interleaved(const unsigned char *pixels,
+                                 size_t stride,
+                                 interleave::PixelFormat format,
+                                 unsigned bpc,
+                                 unsigned image_width,
+                                 unsigned image_height,
+                                 double *matrix23,
+                                 bool flate)
+{
+  // The split buffers are owned by the images, without another copy.
+  size_t samples = (size_t)image_width * image_height * (bpc / 8);
+  ImageBuffer color((unsigned char*)malloc(3 * samples), free);
+  ImageBuffer alpha((unsigned char*)malloc(samples), free);
+  if (!color || !alpha)
+  {
+    throw std::runtime_error("out of memory splitting interleaved pixels");
   }
+  bool translucent = interleave::split(pixels,
+                                       stride,
+                                       image_width,
+                                       image_height,
+                                       bpc,
+                                       format,
+                                       const_cast<unsigned char*>(color.get()),
+                                       const_cast<unsigned char*>(alpha.get()));
+
+  add_image_buffer(color,
+                   translucent ? alpha : ImageBuffer(),
+                   bpc,
+                   3,
+                   image_width,
+                   image_height,
+                   matrix23,
+                   COLORSPACE_DEVICERGB,
+                   flate);
+
+  return;
+}
+
+void Page::add_image_writer(const ImageWriterPtr &writer,
+                            double x_pos,
+                            double y_pos,
+                            double width,
+                            double height)
+{
+  add_image(ImagePtr(new Image(writer, x_pos, y_pos, width, height)));
+
+  return;
+}
+
+void Page::add_image_writer(const ImageWriterPtr &writer, double *matrix23)
+{
+  add_image(ImagePtr(new Image(writer, matrix23)));
 
   return;
 }
@@ -182,12 +435,20 @@ void Page::add_image_mask(const unsigned char *bytes,
                           unsigned *decode,
                           bool flate)
 {
-  page_objects.push_back(ImagePtr(new Image(bytes,
-                                            image_width,
-                                            image_height,
-                                            matrix23,
-                                            decode,
-                                            flate)));
+  add_image(ImagePtr(new Image(bytes,
+                               image_width,
+                               image_height,
+                               matrix23,
+                               decode,
+                               flate)));
+
+  return;
+}
+
+void Page::add_image(const ImagePtr &image)
+{
+  image->set_compression_policy(image_policy);
+  page_objects.push_back(image);
 
   ++images_count;
 
@@ -214,24 +475,24 @@ void Page::set_text_state(const TextStatePtr &new_ts)
   return;
 }
 
-std::ostream& Page::to_stream(
-        std::ostream &out_stream,
-        std::back_insert_iterator<std::vector<std::streamoff> > inserter)
+std::ostream& Page::to_stream(ObjectWriter &writer)
 {
+  std::ostream &out_stream = writer.get_stream();
+
   // We first gather the colorspace information on all the figures on
   // this page.
   gather_image_color_information();
 
-  // Insert first the current offset in the documents object offset
-  // table, passed as a parameter to this function.
-  *inserter++ = out_stream.tellp();
+  // The page dictionary is not a stream, we build it apart and give it
+  // to the writer, which may pack it in an object stream.
+  std::ostringstream page_dict;
 
   // Write the page to the stream.
-  out_stream << object_number << " 0 obj\n<< /Type /Page\n";
+  page_dict << "<< /Type /Page\n";
 
   // For the time being, the page dictionary is object number 3.
-  out_stream << "   /Parent 3 0 R\n";
-  out_stream << "   /MediaBox [ " << mediabox[0] << ' ' << mediabox[1] <<
+  page_dict << "   /Parent 3 0 R\n";
+  page_dict << "   /MediaBox [ " << mediabox[0] << ' ' << mediabox[1] <<
       ' ' << mediabox[2] << ' ' << mediabox[3] << " ]\n";
   if (has_commands ||
       has_text ||
@@ -239,29 +500,29 @@ std::ostream& Page::to_stream(
       rdict->get_images().empty() ||
       !ocgs.empty())
   {
-    out_stream << "   /Contents " << object_number + 1 << " 0 R\n";
-    out_stream << "   /Resources\n   << /ProcSet [ ";
+    page_dict << "   /Contents " << object_number + 1 << " 0 R\n";
+    page_dict << "   /Resources\n   << /ProcSet [ ";
     if (has_commands)
-      out_stream << "/PDF ";
+      page_dict << "/PDF ";
     if (has_text)
-      out_stream << "/Text ";
+      page_dict << "/Text ";
     if (has_images_color)
-      out_stream << "/ImageC ";
+      page_dict << "/ImageC ";
     if (has_images_gray)
-      out_stream << "/ImageB ";
+      page_dict << "/ImageB ";
     if (has_images_indexed)
-      out_stream << "/ImageI ";
-    out_stream << "]\n";
+      page_dict << "/ImageI ";
+    page_dict << "]\n";
 
     if (!ocgs.empty())
     {
-      out_stream << "      /Properties <<\n";
+      page_dict << "      /Properties <<\n";
       for (size_t oi = 0; oi < ocgs.size(); ++oi)
       {
-        out_stream << "                     /" << ocgs[oi]->internal_name <<
+        page_dict << "                     /" << ocgs[oi]->internal_name <<
           ' ' << ocgs[oi]->object_number << " 0 R\n";
       }
-      out_stream << "                  >>\n";
+      page_dict << "                  >>\n";
     }
 
     //
@@ -269,50 +530,52 @@ std::ostream& Page::to_stream(
     //
 
     // Write references to all image objects in the page.
+    // The object numbers of the images were set in set_object_number().
+    // A shared image may appear more than once on the page, but it is
+    // declared once.
     if (images_count > 0)
     {
-      out_stream << "      /XObject <<\n";
-      auto image_number = object_number + 3;
+      page_dict << "      /XObject <<\n";
+      std::vector<unsigned> declared;
       for (size_t i = 0; i < page_objects.size(); ++i)
       {
         if (page_objects[i]->get_type() == PdfObject::Type::IMAGE)
         {
           ImagePtr im=std::dynamic_pointer_cast<Image>(page_objects[i]);
-          im->set_object_number(image_number);
-          out_stream << "                  /Im" << im->get_object_number() <<
-              ' ' << im->get_object_number() << " 0 R\n";
+          if (std::find(declared.begin(), declared.end(),
+                        im->get_object_number()) == declared.end())
+          {
+            declared.push_back(im->get_object_number());
+            page_dict << "                  /Im" << im->get_object_number() <<
+                ' ' << im->get_object_number() << " 0 R\n";
+          }
           // If the image has soft mask, we don't need to declare the soft
-          // mask here. We only assign an object number to the soft mask,
-          // in order to write it down later.
-          image_number += 2;
+          // mask here.
           if (im->has_soft_mask())
           {
             ++i;
-            ImagePtr mask = std::dynamic_pointer_cast<Image>(page_objects[i]);
-            mask->set_object_number(image_number);
-            image_number += 2;
           }
         }
       }
-      out_stream << "      >>\n";
+      page_dict << "      >>\n";
     }
 
-    write_colorspace_resources(out_stream);
+    write_colorspace_resources(page_dict);
 
-    write_resources(out_stream, "Font", "F", rdict->get_fonts());
+    write_resources(page_dict, "Font", "F", rdict->get_fonts());
 
-    write_resources(out_stream, "Pattern", "Pt", rdict->get_patterns());
+    write_resources(page_dict, "Pattern", "Pt", rdict->get_patterns());
 
-    write_resources(out_stream, "ExtGState", "s", rdict->get_graphics_states());
+    write_resources(page_dict, "ExtGState", "s", rdict->get_graphics_states());
 
-    write_resources(out_stream, "Shading", "sh", rdict->get_shadings());
+    write_resources(page_dict, "Shading", "sh", rdict->get_shadings());
 
     for (size_t i = 0; i < custom_page_resources.size(); ++i)
     {
-      out_stream << "      " << custom_page_resources[i] << "\n";
+      page_dict << "      " << custom_page_resources[i] << "\n";
     }
 
-    out_stream << "   >>\n";
+    page_dict << "   >>\n";
 
     //
     //
@@ -320,64 +583,119 @@ std::ostream& Page::to_stream(
 
     // Display page contents, that is, the references here and
     // the objects later.
-    out_stream << ">>\nendobj\n";
-    *inserter++ = out_stream.tellp();
-    out_stream << (object_number+1) << " 0 obj\n<< /Length " <<
-      (object_number+2) << " 0 R >>\nstream\n";
+    page_dict << ">>";
+    writer.write_object(object_number, page_dict.str());
 
-    // Page contents: commands and text.
-    auto stream_start = out_stream.tellp();
-    if (!page_objects.empty())
+    // Compressed objects use the policy of the document.
+    flate::CompressionPolicy policy;
+    if (document_ptr)
     {
-      for (size_t i = 0; i < page_objects.size(); ++i)
+      policy = document_ptr->get_compression_policy();
+    }
+
+    bool use_flate = content_flate == ContentFlate::ALWAYS ||
+      (content_flate == ContentFlate::DOCUMENT && document_ptr &&
+       document_ptr->get_content_flate());
+#ifndef PADDLEFISH_USE_ZLIB
+    use_flate = false;
+#endif
+
+    writer.mark_object(object_number + 1);
+    out_stream << (object_number+1) << " 0 obj\n<< /Length " <<
+      (object_number+2) << " 0 R";
+    if (use_flate)
+    {
+      out_stream << "\n   /Filter [ /FlateDecode ]";
+    }
+    out_stream << " >>\nstream\n";
+
+    // Page contents: commands and text. Without compression, they are
+    // built in a buffer, so that they are written at once and their length
+    // is known. With compression, each object is compressed straight to
+    // the output, reusing the buffer.
+    std::string contents;
+    size_t length = 0;
+#ifdef PADDLEFISH_USE_ZLIB
+    std::unique_ptr<flate::StreamDeflater> deflater;
+    if (use_flate)
+    {
+      deflater.reset(new flate::StreamDeflater(out_stream, policy));
+    }
+#endif
+    for (size_t i = 0; i < page_objects.size(); ++i)
+    {
+      page_objects[i]->append_contents(contents);
+#ifdef PADDLEFISH_USE_ZLIB
+      if (deflater)
       {
-        page_objects[i]->to_stream(out_stream);
-        // If the image has soft mask, then the soft mask must not
-        // be printed in the image; it is only referenced when
-        // declaring the image XObject on the page resources.
-        if (page_objects[i]->get_type() == PdfObject::Type::IMAGE &&
-            std::dynamic_pointer_cast<Image>(page_objects[i])->has_soft_mask())
-        {
-          ++i;
-        }
+        deflater->write(contents.data(), contents.size());
+        contents.clear();
+      }
+#endif
+      // If the image has soft mask, then the soft mask must not
+      // be printed in the image; it is only referenced when
+      // declaring the image XObject on the page resources.
+      if (page_objects[i]->get_type() == PdfObject::Type::IMAGE &&
+          std::dynamic_pointer_cast<Image>(page_objects[i])->has_soft_mask())
+      {
+        ++i;
       }
     }
 
-    auto stream_end = out_stream.tellp();
+#ifdef PADDLEFISH_USE_ZLIB
+    if (deflater)
+    {
+      length = deflater->finish();
+      // The stream is followed by an end of line before endstream.
+      out_stream << '\n';
+    }
+    else
+#endif
+    {
+      out_stream.write(contents.data(), contents.size());
+      length = contents.size();
+    }
     out_stream << "endstream\nendobj\n";
     // Write now the stream length object.
-    *inserter++ = out_stream.tellp();
-    out_stream << (object_number+2) << " 0 obj\n   " <<
-      stream_end-stream_start << "\nendobj\n";
-    // Write the referenced images, the first object number
-    // is object_number+3.
-    auto image_number = object_number + 3;
+    writer.write_object(object_number + 2, "   " + util::to_str(length));
+    // Write the referenced images, except the ones already written by
+    // another page.
     for(size_t ii = 0; ii < page_objects.size(); ++ii)
     {
       if(page_objects[ii]->get_type() == PdfObject::Type::IMAGE)
       {
-        *inserter++ = out_stream.tellp();
         ImagePtr im = std::dynamic_pointer_cast<Image>(page_objects[ii]);
-        auto written = im->write_image(out_stream, image_number);
-        *inserter++ = out_stream.tellp();
-        out_stream << (image_number + 1) << " 0 obj\n   " << written <<
-          "\nendobj\n";
-        image_number += 2;
+        if (im->is_shared())
+        {
+          continue;
+        }
+        auto image_number = im->get_object_number();
+        writer.mark_object(image_number);
+        flate::Sampling sampling = flate::Sampling::NONE;
+        auto written = im->write_image(out_stream,
+                                       image_number,
+                                       policy,
+                                       &sampling);
+        if (document_ptr)
+        {
+          document_ptr->count_sampling(sampling, written);
+        }
+        writer.write_object(image_number + 1, "   " + util::to_str(written));
       }
     }
 
     // Write the OCG objects.
     for (size_t oi = 0; oi < ocgs.size(); ++oi)
     {
-      *inserter++ = out_stream.tellp();
-      out_stream << ocgs[oi]->object_number << " 0 obj\n<< /Name (" <<
-        util::escape_string(ocgs[oi]->name) <<
-        ")\n   /Type /OCG\n>>\nendobj\n";
+      writer.write_object(ocgs[oi]->object_number,
+                          "<< /Name (" + util::escape_string(ocgs[oi]->name) +
+                          ")\n   /Type /OCG\n>>");
     }
   }
   else
   {
-    out_stream << ">>\nendobj\n";
+    page_dict << ">>";
+    writer.write_object(object_number, page_dict.str());
   }
 
   return out_stream;
@@ -408,8 +726,72 @@ unsigned Page::set_object_number(unsigned id)
   // anyway.
   unsigned ret = object_number + 3;
 
-  // We reserve two object numbers per page image and one per OCG.
-  ret += (2 * images_count);
+  // We reserve two object numbers per page image and one per OCG. Images
+  // identical to one already numbered in the document take its number
+  // and are not written again. An image and its soft mask are shared
+  // together, since the image refers to the mask by its number.
+  for (size_t i = 0; i < page_objects.size(); ++i)
+  {
+    if (page_objects[i]->get_type() == PdfObject::Type::IMAGE)
+    {
+      ImagePtr im = std::dynamic_pointer_cast<Image>(page_objects[i]);
+      ImagePtr mask;
+      if (im->has_soft_mask())
+      {
+        mask = std::dynamic_pointer_cast<Image>(page_objects[++i]);
+      }
+
+      // Images drawn at a lower resolution than they have are resampled
+      // first, so that they are deduplicated by their final pixels. The
+      // filters blend neighbouring samples, so only images whose samples
+      // are intensities are resampled; the samples of indexed images are
+      // palette entries, and blending them would give other colors.
+      if (document_ptr)
+      {
+        double dpi = document_ptr->get_max_image_resolution();
+        resample::Filter filter = document_ptr->get_image_resampling_filter();
+        const ColorspaceProperties *cs =
+          document_ptr->get_colorspace_properties(im->get_colorspace());
+        if (cs &&
+            (cs->colorspace_type == ColorspaceProperties::Type::DEVICE ||
+             cs->colorspace_type == ColorspaceProperties::Type::ICC_BASED ||
+             cs->colorspace_type == ColorspaceProperties::Type::CALRGB ||
+             cs->colorspace_type == ColorspaceProperties::Type::CALGRAY ||
+             cs->colorspace_type == ColorspaceProperties::Type::SEPARATION))
+        {
+          im->limit_resolution(dpi, filter);
+        }
+        if (mask)
+        {
+          mask->limit_resolution(dpi, filter);
+        }
+      }
+
+      im->set_object_number(ret);
+      unsigned shared_number =
+        document_ptr ? document_ptr->share_image(im, mask) : 0;
+      if (shared_number)
+      {
+        im->set_object_number(shared_number);
+        im->set_shared(true);
+      }
+      else
+      {
+        im->set_shared(false);
+        ret += 2;
+      }
+
+      if (mask)
+      {
+        mask->set_object_number(im->get_object_number() + 2);
+        mask->set_shared(im->is_shared());
+        if (!mask->is_shared())
+        {
+          ret += 2;
+        }
+      }
+    }
+  }
 
   // Before returning, we set the object number of the OCG's.
   for (unsigned iocg = 0; iocg < ocgs.size(); ++iocg)
@@ -0,0 +1,265 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <paddlefish/palette.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace paddlefish {
+namespace palette {
+
+static const unsigned MAX_COLORS = 256;
+
+// The slots of the hash table; four per color keep the probes short.
+static const unsigned TABLE_BITS = 10;
+static const unsigned TABLE_SLOTS = 1 << TABLE_BITS;
+static const std::uint32_t NO_COLOR = 0xffffffffu;
+
+// An open addressing hash table of up to 256 colors, packed as 0xRRGGBB,
+// with the index of each one.
+class ColorTable
+{
+  public:
+    ColorTable():
+      keys(TABLE_SLOTS, NO_COLOR),
+      indices(TABLE_SLOTS, 0),
+      count(0)
+    {}
+
+    // Returns the slot of the color, which is empty if the color is not in
+    // the table.
+    unsigned find(std::uint32_t color)const
+    {
+      unsigned slot = (color * 0x9e3779b1u) >> (32 - TABLE_BITS);
+      while (keys[slot] != NO_COLOR && keys[slot] != color)
+      {
+        slot = (slot + 1) & (TABLE_SLOTS - 1);
+      }
+      return slot;
+    }
+
+    // Adds the color, if it is new, with the next index. Returns false if
+    // the table is full.
+    bool insert(std::uint32_t color)
+    {
+      unsigned slot = find(color);
+      if (keys[slot] == NO_COLOR)
+      {
+        if (count == MAX_COLORS)
+        {
+          return false;
+        }
+        keys[slot] = color;
+        indices[slot] = (unsigned char)count++;
+      }
+      return true;
+    }
+
+    unsigned char index(std::uint32_t color)const
+    {
+      return indices[find(color)];
+    }
+
+    void set_index(std::uint32_t color, unsigned char i)
+    {
+      indices[find(color)] = i;
+      return;
+    }
+
+    std::vector<std::uint32_t> colors()const
+    {
+      std::vector<std::uint32_t> c;
+      for (unsigned slot = 0; slot < TABLE_SLOTS; ++slot)
+      {
+        if (keys[slot] != NO_COLOR)
+        {
+          c.push_back(keys[slot]);
+        }
+      }
+      return c;
+    }
+
+  private:
+    std::vector<std::uint32_t> keys;
+    std::vector<unsigned char> indices;
+    unsigned count;
+};
+
+static inline std::uint32_t pixel_color(const unsigned char *p)
+{
+  return (std::uint32_t)p[0] << 16 | (std::uint32_t)p[1] << 8 | p[2];
+}
+
+// Fills the table with the colors of the image. Returns false if it has
+// more than 256 colors. Consecutive pixels of the same color, as in charts
+// and screenshots, are skipped without looking up the table.
+static bool collect_colors(const unsigned char *data,
+                           size_t stride,
+                           unsigned width,
+                           unsigned height,
+                           ColorTable &table)
+{
+  std::uint32_t last = NO_COLOR;
+  for (unsigned y = 0; y < height; ++y)
+  {
+    const unsigned char *row = data + y * stride;
+    const unsigned char *end = row + 3 * (size_t)width;
+    for (const unsigned char *p = row; p < end; p += 3)
+    {
+      std::uint32_t color = pixel_color(p);
+      if (color != last)
+      {
+        if (!table.insert(color))
+        {
+          return false;
+        }
+        last = color;
+      }
+    }
+  }
+
+  return true;
+}
+
+Reduction analyze(const unsigned char *data,
+                  size_t stride,
+                  unsigned width,
+                  unsigned height,
+                  bool gray)
+{
+  Reduction reduction;
+  ColorTable table;
+  if (width == 0 || height == 0 ||
+      !collect_colors(data, stride, width, height, table))
+  {
+    return reduction;
+  }
+
+  std::vector<std::uint32_t> colors = table.colors();
+  std::sort(colors.begin(), colors.end());
+
+  bool neutral = true;
+  for (size_t i = 0; i < colors.size(); ++i)
+  {
+    unsigned r = colors[i] >> 16, g = (colors[i] >> 8) & 0xff;
+    unsigned b = colors[i] & 0xff;
+    neutral = neutral && r == g && g == b;
+  }
+
+  if (colors.size() <= 2)
+  {
+    reduction.bits_per_component = 1;
+  }
+  else if (colors.size() <= 4)
+  {
+    reduction.bits_per_component = 2;
+  }
+  else if (colors.size() <= 16)
+  {
+    reduction.bits_per_component = 4;
+  }
+  else if (neutral && gray)
+  {
+    reduction.type = Reduction::Type::GRAY;
+    return reduction;
+  }
+
+  reduction.type = Reduction::Type::INDEXED;
+  for (size_t i = 0; i < colors.size(); ++i)
+  {
+    reduction.colors += (char)(colors[i] >> 16);
+    reduction.colors += (char)(colors[i] >> 8);
+    reduction.colors += (char)colors[i];
+  }
+
+  return reduction;
+}
+
+void reduce(const unsigned char *data,
+            size_t stride,
+            unsigned width,
+            unsigned height,
+            const Reduction &reduction,
+            std::string &out)
+{
+  if (reduction.type == Reduction::Type::GRAY)
+  {
+    size_t start = out.size();
+    out.resize(start + (size_t)width * height);
+    char *o = &out[start];
+    for (unsigned y = 0; y < height; ++y)
+    {
+      const unsigned char *row = data + y * stride;
+      for (unsigned x = 0; x < width; ++x)
+      {
+        *o++ = (char)row[3 * x];
+      }
+    }
+    return;
+  }
+
+  // The indices follow the order of the sorted colors.
+  ColorTable table;
+  const std::string &colors = reduction.colors;
+  for (size_t i = 0; i < colors.size() / 3; ++i)
+  {
+    std::uint32_t color =
+      pixel_color(reinterpret_cast<const unsigned char*>(&colors[3 * i]));
+    table.insert(color);
+    table.set_index(color, (unsigned char)i);
+  }
+
+  unsigned bits = reduction.bits_per_component;
+  size_t row_size = ((size_t)width * bits + 7) / 8;
+  size_t start = out.size();
+  out.resize(start + row_size * height, '\0');
+  unsigned char *o = reinterpret_cast<unsigned char*>(&out[start]);
+  std::uint32_t last = NO_COLOR;
+  unsigned char last_index = 0;
+  for (unsigned y = 0; y < height; ++y, o += row_size)
+  {
+    const unsigned char *row = data + y * stride;
+    for (unsigned x = 0; x < width; ++x)
+    {
+      std::uint32_t color = pixel_color(row + 3 * x);
+      if (color != last)
+      {
+        last_index = table.index(color);
+        last = color;
+      }
+      if (bits == 8)
+      {
+        o[x] = last_index;
+      }
+      else
+      {
+        // The first pixel goes to the most significant bits.
+        unsigned shift = 8 - bits - (x * bits) % 8;
+        o[x * bits / 8] |= (unsigned char)(last_index << shift);
+      }
+    }
+  }
+
+  return;
+}
+
+} // namespace palette
+} // namespace paddlefish
+
+// vim: ts=2:sw=2:expandtab
@@ -0,0 +1,262 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <paddlefish/colorspace_properties.h>
+#include <paddlefish/png.h>
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace paddlefish {
+namespace png {
+
+static const unsigned char SIGNATURE[8] =
+  { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+// The color types of the IHDR chunk.
+static const unsigned GRAY = 0;
+static const unsigned RGB = 2;
+static const unsigned INDEXED = 3;
+static const unsigned GRAY_ALPHA = 4;
+static const unsigned RGB_ALPHA = 6;
+
+static unsigned read_u16(const unsigned char *p)
+{
+  return ((unsigned)p[0] << 8) | p[1];
+}
+
+static size_t read_u32(const unsigned char *p)
+{
+  return ((size_t)p[0] << 24) | ((size_t)p[1] << 16) |
+    ((size_t)p[2] << 8) | p[3];
+}
+
+static bool valid_bit_depth(unsigned color_type, unsigned bit_depth)
+{
+  switch (color_type)
+  {
+    case GRAY:
+      return bit_depth == 1 || bit_depth == 2 || bit_depth == 4 ||
+        bit_depth == 8 || bit_depth == 16;
+    case INDEXED:
+      return bit_depth == 1 || bit_depth == 2 || bit_depth == 4 ||
+        bit_depth == 8;
+    case RGB:
+    case GRAY_ALPHA:
+    case RGB_ALPHA:
+      return bit_depth == 8 || bit_depth == 16;
+    default:
+      return false;
+  }
+}
+
+static void read_header(const unsigned char *chunk,
+                        size_t length,
+                        PngInfo &info)
+{
+  if (length != 13)
+  {
+    throw std::runtime_error("invalid PNG header");
+  }
+  info.width = (unsigned)read_u32(chunk);
+  info.height = (unsigned)read_u32(chunk + 4);
+  info.bit_depth = chunk[8];
+  info.color_type = chunk[9];
+
+  if (info.width == 0 || info.height == 0 ||
+      !valid_bit_depth(info.color_type, info.bit_depth) ||
+      chunk[10] != 0 || chunk[11] != 0)
+  {
+    throw std::runtime_error("invalid PNG header");
+  }
+  // The rows of interlaced images are not in order, and PDF readers know
+  // nothing about the alpha channel.
+  if (chunk[12] != 0)
+  {
+    throw std::runtime_error("unsupported interlaced PNG image");
+  }
+  if (info.color_type == GRAY_ALPHA || info.color_type == RGB_ALPHA)
+  {
+    throw std::runtime_error("unsupported PNG image with alpha channel");
+  }
+
+  return;
+}
+
+// Transparent palette entries become a range of masked indices, which
+// can only represent consecutive entries that are fully transparent.
+static void read_palette_alpha(const unsigned char *chunk,
+                               size_t length,
+                               PngInfo &info)
+{
+  size_t entries = info.palette.size() / 3;
+  if (length > entries)
+  {
+    throw std::runtime_error("invalid PNG transparency");
+  }
+
+  size_t first = entries, last = 0;
+  for (size_t i = 0; i < length; ++i)
+  {
+    if (chunk[i] == 0)
+    {
+      first = i < first ? i : first;
+      last = i;
+    }
+    else if (chunk[i] != 255)
+    {
+      throw std::runtime_error("unsupported PNG image with translucent "
+                               "colors");
+    }
+  }
+  if (first == entries)
+  {
+    return;
+  }
+  for (size_t i = first; i <= last; ++i)
+  {
+    if (chunk[i] != 0)
+    {
+      throw std::runtime_error("unsupported PNG image with transparent "
+                               "colors out of order");
+    }
+  }
+  info.color_key.push_back((unsigned)first);
+  info.color_key.push_back((unsigned)last);
+
+  return;
+}
+
+static void read_transparency(const unsigned char *chunk,
+                              size_t length,
+                              PngInfo &info)
+{
+  switch (info.color_type)
+  {
+    case INDEXED:
+      read_palette_alpha(chunk, length, info);
+      break;
+    case GRAY:
+    case RGB:
+      if (length != 2 * components(info))
+      {
+        throw std::runtime_error("invalid PNG transparency");
+      }
+      for (unsigned c = 0; c < components(info); ++c)
+      {
+        unsigned value = read_u16(chunk + 2 * c);
+        info.color_key.push_back(value);
+        info.color_key.push_back(value);
+      }
+      break;
+  }
+
+  return;
+}
+
+PngInfo read_info(const unsigned char *data, size_t size)
+{
+  if (size < 8 || memcmp(data, SIGNATURE, 8) != 0)
+  {
+    throw std::runtime_error("not a PNG image");
+  }
+
+  PngInfo info;
+  size_t pos = 8;
+  while (pos + 12 <= size)
+  {
+    size_t length = read_u32(data + pos);
+    const unsigned char *type = data + pos + 4;
+    const unsigned char *chunk = data + pos + 8;
+    if (length > size - pos - 12)
+    {
+      break;
+    }
+
+    if (memcmp(type, "IHDR", 4) == 0)
+    {
+      read_header(chunk, length, info);
+    }
+    else if (info.width == 0)
+    {
+      throw std::runtime_error("PNG header not found");
+    }
+    else if (memcmp(type, "PLTE", 4) == 0)
+    {
+      if (length == 0 || length % 3 != 0 || length > 3 * 256)
+      {
+        throw std::runtime_error("invalid PNG palette");
+      }
+      // Other images may suggest a palette, which is not needed here.
+      if (info.color_type == INDEXED)
+      {
+        info.palette.assign(reinterpret_cast<const char*>(chunk), length);
+      }
+    }
+    else if (memcmp(type, "tRNS", 4) == 0)
+    {
+      read_transparency(chunk, length, info);
+    }
+    else if (memcmp(type, "IDAT", 4) == 0)
+    {
+      if (length > 0)
+      {
+        info.data.push_back(std::make_pair(pos + 8, length));
+      }
+    }
+    else if (memcmp(type, "IEND", 4) == 0)
+    {
+      if (info.data.empty())
+      {
+        throw std::runtime_error("PNG image without data");
+      }
+      if (info.color_type == INDEXED && info.palette.empty())
+      {
+        throw std::runtime_error("PNG palette not found");
+      }
+      return info;
+    }
+    // Chunks which are not ancillary change how the data is decoded.
+    else if (!(type[0] & 0x20))
+    {
+      throw std::runtime_error("unsupported PNG chunk: " +
+                               std::string(reinterpret_cast<const char*>(type),
+                                           4));
+    }
+
+    pos += length + 12;
+  }
+
+  throw std::runtime_error("truncated PNG image");
+}
+
+unsigned components(const PngInfo &info)
+{
+  return info.color_type == RGB ? 3 : 1;
+}
+
+unsigned colorspace(const PngInfo &info)
+{
+  return info.color_type == GRAY ? COLORSPACE_DEVICEGRAY :
+                                   COLORSPACE_DEVICERGB;
+}
+
+} // namespace png
+} // namespace paddlefish
+
+// vim: ts=2:sw=2:expandtab
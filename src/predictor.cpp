@@ -0,0 +1,169 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <paddlefish/predictor.h>
+#include <paddlefish/util.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+namespace paddlefish {
+namespace predictor {
+
+// The filters of PNG, in the order of their type bytes.
+enum Filter
+{
+  NONE,
+  SUB,
+  UP,
+  AVERAGE,
+  PAETH,
+  FILTERS
+};
+
+// The loops below have no branches nor dependencies between iterations,
+// so that compilers can vectorize them.
+
+static inline int paeth(int a, int b, int c)
+{
+  int pa = std::abs(b - c);
+  int pb = std::abs(a - c);
+  int pc = std::abs(a + b - 2 * c);
+  int ab = pa <= pb && pa <= pc;
+  int bc = !ab & (pb <= pc);
+  return ab * a + bc * b + (1 - ab - bc) * c;
+}
+
+// Filter a row. The previous row is all zeros for the first one.
+static void filter_row(const unsigned char *row,
+                       const unsigned char *prev,
+                       size_t stride,
+                       size_t bpp,
+                       unsigned char **out)
+{
+  // The bytes written could alias the array of pointers, so they are
+  // read first.
+  unsigned char *sub = out[SUB];
+  unsigned char *up = out[UP];
+  unsigned char *average = out[AVERAGE];
+  unsigned char *paeth_row = out[PAETH];
+
+  size_t first = bpp < stride ? bpp : stride;
+  for (size_t i = 0; i < first; ++i)
+  {
+    sub[i] = row[i];
+    up[i] = (unsigned char)(row[i] - prev[i]);
+    average[i] = (unsigned char)(row[i] - (prev[i] >> 1));
+    paeth_row[i] = (unsigned char)(row[i] - prev[i]);
+  }
+  // A loop for each filter keeps the checks of aliasing simple enough.
+  for (size_t i = first; i < stride; ++i)
+  {
+    sub[i] = (unsigned char)(row[i] - row[i - bpp]);
+  }
+  for (size_t i = first; i < stride; ++i)
+  {
+    up[i] = (unsigned char)(row[i] - prev[i]);
+  }
+  for (size_t i = first; i < stride; ++i)
+  {
+    average[i] = (unsigned char)(row[i] - ((row[i - bpp] + prev[i]) >> 1));
+  }
+  for (size_t i = first; i < stride; ++i)
+  {
+    paeth_row[i] = (unsigned char)(row[i] -
+                                   paeth(row[i - bpp], prev[i], prev[i - bpp]));
+  }
+
+  return;
+}
+
+// The sum of the filtered bytes taken as signed values, which estimates
+// how well they compress.
+static size_t score(const unsigned char *row, size_t stride)
+{
+  size_t sum = 0;
+  for (size_t i = 0; i < stride; ++i)
+  {
+    sum += (size_t)std::abs((int)(signed char)row[i]);
+  }
+
+  return sum;
+}
+
+void png_filter(const unsigned char *data,
+                size_t stride,
+                size_t rows,
+                unsigned bytes_per_pixel,
+                std::string &out,
+                const unsigned char *previous)
+{
+  size_t bpp = bytes_per_pixel ? bytes_per_pixel : 1;
+  std::vector<unsigned char> scratch(stride * (FILTERS + 1));
+  unsigned char *filtered[FILTERS];
+  for (int f = SUB; f < FILTERS; ++f)
+  {
+    filtered[f] = scratch.data() + stride * f;
+  }
+  const unsigned char *zeros = scratch.data() + stride * FILTERS;
+  if (!previous)
+  {
+    previous = zeros;
+  }
+
+  size_t start = out.size();
+  out.resize(start + rows * (stride + 1));
+  unsigned char *o = reinterpret_cast<unsigned char*>(&out[start]);
+
+  for (size_t r = 0; r < rows; ++r)
+  {
+    const unsigned char *row = data + r * stride;
+    filtered[NONE] = const_cast<unsigned char*>(row);
+    filter_row(row, r ? row - stride : previous, stride, bpp, filtered);
+
+    int best = NONE;
+    size_t best_score = score(row, stride);
+    for (int f = SUB; f < FILTERS; ++f)
+    {
+      size_t s = score(filtered[f], stride);
+      if (s < best_score)
+      {
+        best = f;
+        best_score = s;
+      }
+    }
+
+    *o++ = (unsigned char)best;
+    std::copy(filtered[best], filtered[best] + stride, o);
+    o += stride;
+  }
+
+  return;
+}
+
+std::string png_decode_parms(unsigned colors, unsigned bpc, unsigned columns)
+{
+  return "[ << /Predictor 15 /Colors " + util::to_str(colors) +
+    " /BitsPerComponent " + util::to_str(bpc) +
+    " /Columns " + util::to_str(columns) + " >> ]";
+}
+
+} // namespace predictor
+} // namespace paddlefish
+
+// vim: ts=2:sw=2:expandtab
@@ -0,0 +1,212 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <paddlefish/resample.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace paddlefish {
+namespace resample {
+
+// The bits of the fractional part of the weights.
+static const int PRECISION = 14;
+
+static const double PI = 3.14159265358979323846;
+
+static double filter_radius(Filter filter)
+{
+  switch (filter)
+  {
+  case Filter::BOX:
+    return 0.5;
+  case Filter::BILINEAR:
+    return 1.;
+  default:
+    return 3.;
+  }
+}
+
+static double sinc(double x)
+{
+  if (x == 0.)
+  {
+    return 1.;
+  }
+  x *= PI;
+  return std::sin(x) / x;
+}
+
+static double filter_value(Filter filter, double x)
+{
+  switch (filter)
+  {
+  case Filter::BOX:
+    return (x >= -0.5 && x < 0.5) ? 1. : 0.;
+  case Filter::BILINEAR:
+    x = std::fabs(x);
+    return x < 1. ? 1. - x : 0.;
+  default:
+    return std::fabs(x) < 3. ? sinc(x) * sinc(x / 3.) : 0.;
+  }
+}
+
+// The input pixels which contribute to each output pixel along one axis,
+// and their weights in fixed point.
+struct Weights
+{
+  std::vector<unsigned> first;
+  std::vector<unsigned> count;
+  // The weights of output pixel i start at i * taps.
+  std::vector<std::int32_t> values;
+  unsigned taps;
+};
+
+static Weights compute_weights(unsigned in_size,
+                               unsigned out_size,
+                               Filter filter)
+{
+  // When reducing, the filter is widened to cover all the input pixels.
+  double scale = (double)in_size / out_size;
+  double filter_scale = std::max(scale, 1.);
+  double support = filter_radius(filter) * filter_scale;
+
+  Weights weights;
+  weights.taps = (unsigned)std::ceil(support) * 2 + 1;
+  weights.first.resize(out_size);
+  weights.count.resize(out_size);
+  weights.values.assign((size_t)out_size * weights.taps, 0);
+
+  std::vector<double> w(weights.taps);
+  for (unsigned i = 0; i < out_size; ++i)
+  {
+    double center = (i + 0.5) * scale;
+    int low = std::max(0, (int)std::floor(center - support + 0.5));
+    int high = std::min((int)in_size,
+                        (int)std::floor(center + support + 0.5));
+    high = std::min(high, low + (int)weights.taps);
+
+    double sum = 0.;
+    for (int k = low; k < high; ++k)
+    {
+      w[k - low] = filter_value(filter, (k + 0.5 - center) / filter_scale);
+      sum += w[k - low];
+    }
+    // The nearest pixel, if no pixel falls in the filter.
+    if (sum == 0.)
+    {
+      low = std::min((int)center, (int)in_size - 1);
+      high = low + 1;
+      w[0] = sum = 1.;
+    }
+
+    weights.first[i] = low;
+    weights.count[i] = high - low;
+    // The rounding error goes to the biggest weight, so that the weights
+    // add exactly one and flat areas keep their value.
+    std::int32_t *values = &weights.values[(size_t)i * weights.taps];
+    std::int32_t total = 0;
+    int biggest = 0;
+    for (int k = 0; k < high - low; ++k)
+    {
+      values[k] = (std::int32_t)std::lround(w[k] / sum * (1 << PRECISION));
+      total += values[k];
+      biggest = values[k] > values[biggest] ? k : biggest;
+    }
+    values[biggest] += (1 << PRECISION) - total;
+  }
+
+  return weights;
+}
+
+static inline unsigned char clamp_value(std::int32_t v)
+{
+  v += 1 << (PRECISION - 1);
+  if (v < 0)
+  {
+    return 0;
+  }
+  v >>= PRECISION;
+  return v > 255 ? 255 : (unsigned char)v;
+}
+
+void resample(const unsigned char *data,
+              size_t stride,
+              unsigned width,
+              unsigned height,
+              unsigned channels,
+              unsigned char *out,
+              unsigned out_width,
+              unsigned out_height,
+              Filter filter)
+{
+  size_t row_size = (size_t)out_width * channels;
+
+  // Horizontal pass, to a buffer with the new width and the old height.
+  Weights h = compute_weights(width, out_width, filter);
+  std::vector<unsigned char> narrow(row_size * height);
+  for (unsigned y = 0; y < height; ++y)
+  {
+    const unsigned char *row = data + y * stride;
+    unsigned char *narrow_row = &narrow[y * row_size];
+    for (unsigned x = 0; x < out_width; ++x)
+    {
+      const std::int32_t *w = &h.values[(size_t)x * h.taps];
+      const unsigned char *pixel = row + (size_t)h.first[x] * channels;
+      for (unsigned c = 0; c < channels; ++c)
+      {
+        std::int32_t sum = 0;
+        for (unsigned k = 0; k < h.count[x]; ++k)
+        {
+          sum += w[k] * pixel[k * channels + c];
+        }
+        narrow_row[x * channels + c] = clamp_value(sum);
+      }
+    }
+  }
+
+  // Vertical pass. Whole rows are accumulated at once.
+  Weights v = compute_weights(height, out_height, filter);
+  std::vector<std::int32_t> sums(row_size);
+  for (unsigned y = 0; y < out_height; ++y)
+  {
+    std::fill(sums.begin(), sums.end(), 0);
+    const std::int32_t *w = &v.values[(size_t)y * v.taps];
+    for (unsigned k = 0; k < v.count[y]; ++k)
+    {
+      const unsigned char *row = &narrow[(v.first[y] + k) * row_size];
+      std::int32_t weight = w[k];
+      for (size_t i = 0; i < row_size; ++i)
+      {
+        sums[i] += weight * row[i];
+      }
+    }
+    unsigned char *out_row = out + y * row_size;
+    for (size_t i = 0; i < row_size; ++i)
+    {
+      out_row[i] = clamp_value(sums[i]);
+    }
+  }
+
+  return;
+}
+
+} // namespace resample
+} // namespace paddlefish
+
+// vim: ts=2:sw=2:expandtab
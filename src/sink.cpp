@@ -0,0 +1,267 @@
+// Copyright (c) 2022 Luis Peñaranda. All rights reserved.
+//
+// This file is part of paddlefish.
+//
+// Paddlefish is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Paddlefish is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with paddlefish.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <paddlefish/sink.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#ifdef PADDLEFISH_WINDOWS
+#include <io.h>
+#else
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace paddlefish {
+
+void OstreamSink::flush()
+{
+  out.flush();
+
+  return;
+}
+
+void OstreamSink::do_write(const char *data, size_t size)
+{
+  if (!out.write(data, size))
+  {
+    throw std::runtime_error("error writing to the output stream");
+  }
+
+  return;
+}
+
+FdSink::FdSink(int file_descriptor, size_t buffer_size):
+  fd(file_descriptor),
+  buffer(buffer_size ? buffer_size : 1),
+  buffered(0)
+{}
+
+FdSink::~FdSink()
+{
+  // Destructors must not throw; call flush() to see the errors.
+  try
+  {
+    flush();
+  }
+  catch (...)
+  {
+  }
+}
+
+void FdSink::flush()
+{
+  if (buffered > 0)
+  {
+    write_out(nullptr, 0);
+  }
+
+  return;
+}
+
+void FdSink::do_write(const char *data, size_t size)
+{
+  if (size <= buffer.size() - buffered)
+  {
+    std::memcpy(buffer.data() + buffered, data, size);
+    buffered += size;
+  }
+  else if (size < buffer.size() / 2)
+  {
+    write_out(nullptr, 0);
+    std::memcpy(buffer.data(), data, size);
+    buffered = size;
+  }
+  else
+  {
+    write_out(data, size);
+  }
+
+  return;
+}
+
+void FdSink::write_out(const char *data, size_t size)
+{
+#ifdef PADDLEFISH_WINDOWS
+  const char *chunks[2] = { buffer.data(), data };
+  size_t sizes[2] = { buffered, size };
+  for (int c = 0; c < 2; ++c)
+  {
+    while (sizes[c] > 0)
+    {
+      unsigned chunk = sizes[c] > 0x40000000 ? 0x40000000 : (unsigned)sizes[c];
+      int n = _write(fd, chunks[c], chunk);
+      if (n < 0)
+      {
+        throw std::runtime_error(std::string("error writing to descriptor: ") +
+                                 std::strerror(errno));
+      }
+      chunks[c] += n;
+      sizes[c] -= n;
+    }
+  }
+#else
+  struct iovec iov[2];
+  int iov_count = 0;
+  if (buffered > 0)
+  {
+    iov[iov_count].iov_base = buffer.data();
+    iov[iov_count].iov_len = buffered;
+    ++iov_count;
+  }
+  if (size > 0)
+  {
+    iov[iov_count].iov_base = const_cast<char*>(data);
+    iov[iov_count].iov_len = size;
+    ++iov_count;
+  }
+
+  // A write to a pipe or a socket can be partial.
+  struct iovec *first = iov;
+  while (iov_count > 0)
+  {
+    ssize_t n = ::writev(fd, first, iov_count);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      throw std::runtime_error(std::string("error writing to descriptor: ") +
+                               std::strerror(errno));
+    }
+    while (iov_count > 0 && (size_t)n >= first->iov_len)
+    {
+      n -= first->iov_len;
+      ++first;
+      --iov_count;
+    }
+    if (iov_count > 0)
+    {
+      first->iov_base = (char*)first->iov_base + n;
+      first->iov_len -= n;
+    }
+  }
+#endif
+
+  buffered = 0;
+
+  return;
+}
+
+SinkStreambuf::SinkStreambuf(Sink &out_sink, size_t buffer_size):
+  sink(out_sink),
+  buffer(buffer_size ? buffer_size : 1)
+{
+  setp(buffer.data(), buffer.data() + buffer.size());
+}
+
+SinkStreambuf::~SinkStreambuf()
+{
+  try
+  {
+    flush_buffer();
+  }
+  catch (...)
+  {
+  }
+}
+
+SinkStreambuf::int_type SinkStreambuf::overflow(int_type c)
+{
+  flush_buffer();
+  if (!traits_type::eq_int_type(c, traits_type::eof()))
+  {
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+  }
+
+  return traits_type::not_eof(c);
+}
+
+std::streamsize SinkStreambuf::xsputn(const char *s, std::streamsize n)
+{
+  std::streamsize available = epptr() - pptr();
+  if (n <= available)
+  {
+    std::memcpy(pptr(), s, n);
+    pbump((int)n);
+  }
+  else
+  {
+    // Big writes go straight to the sink, after the buffered bytes.
+    flush_buffer();
+    if (n < (std::streamsize)buffer.size())
+    {
+      std::memcpy(pptr(), s, n);
+      pbump((int)n);
+    }
+    else
+    {
+      sink.write(s, n);
+    }
+  }
+
+  return n;
+}
+
+int SinkStreambuf::sync()
+{
+  flush_buffer();
+  sink.flush();
+
+  return 0;
+}
+
+SinkStreambuf::pos_type SinkStreambuf::seekoff(off_type off,
+                                               std::ios_base::seekdir dir,
+                                               std::ios_base::openmode which)
+{
+  // Only telling the position is supported.
+  if (off != 0 || dir != std::ios_base::cur || !(which & std::ios_base::out))
+  {
+    return pos_type(off_type(-1));
+  }
+
+  return pos_type(sink.position() + (pptr() - pbase()));
+}
+
+void SinkStreambuf::flush_buffer()
+{
+  if (pptr() > pbase())
+  {
+    sink.write(pbase(), pptr() - pbase());
+    setp(buffer.data(), buffer.data() + buffer.size());
+  }
+
+  return;
+}
+
+SinkStream::SinkStream(Sink &out_sink):
+  std::ostream(nullptr),
+  buffer(out_sink)
+{
+  rdbuf(&buffer);
+  exceptions(std::ios_base::badbit);
+}
+
+} // namespace paddlefish
+
+// vim: ts=2:sw=2:expandtab
@@ -75,28 +75,33 @@ Text::Text(double *matrix23, const std::vector<std::string> &text, bool map):
   }
 }
 
-const std::string Text::get_contents() const
+void Text::append_contents(std::string &contents) const
 {
   // Start text block.
-  std::string contents = "BT\n";
+  contents += "BT\n";
 
   // Write positioning. If the upper text matrix is identity, only
   // specify text position.
   if (text_matrix[0] == 1. && text_matrix[1] == 0. &&
       text_matrix[2] == 0. && text_matrix[3] == 1.)
   {
-    contents += util::to_str(text_matrix[4]) + ' ' +
-      util::to_str(text_matrix[5]) + " Td\n";
+    contents += util::to_str(text_matrix[4]);
+    contents += ' ';
+    contents += util::to_str(text_matrix[5]);
+    contents += " Td\n";
   }
   else
   {
-    contents += util::vector_to_string(text_matrix, 6) + " Tm\n";
+    contents += util::vector_to_string(text_matrix, 6);
+    contents += " Tm\n";
   }
 
   // Write the text lines.
   for (size_t i = 0; i < lines.size(); ++i)
   {
-    contents += '(' + util::escape_string(lines[i]) + ") Tj\n";
+    contents += '(';
+    contents += util::escape_string(lines[i]);
+    contents += ") Tj\n";
     if (i < lines.size() - 1)
     {
       contents += "T*\n";
@@ -106,7 +111,7 @@ const std::string Text::get_contents() const
   // End text block.
   contents += "ET\n";
 
-  return contents;
+  return;
 }
 
 void Text::add_zeroes()